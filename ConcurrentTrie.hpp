@@ -0,0 +1,655 @@
+#ifndef CONCURRENT_TRIE_HPP
+#define CONCURRENT_TRIE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <type_traits>
+
+#include "Trie.hpp"
+
+namespace jzt {
+
+namespace detail {
+
+namespace qp {
+
+//epoch based reclamation for one writer and any number of readers
+//a reader announces itself on one of the two counters of a slot picked by its thread, so readers
+//on different slots never write to the same cache line. a grace period flips the epoch and waits
+//for the counter of the old epoch to drain, twice, so every reader that began before it is gone
+class EpochDomain
+{
+public:
+    static constexpr unsigned Slots = 128;
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> readers[2];
+    };
+
+    std::atomic<uint64_t> epoch;
+    Slot slots[Slots];
+
+    static unsigned thread_slot()
+    {
+        static std::atomic<unsigned> next(0);
+        thread_local unsigned slot = next.fetch_add(1, std::memory_order_relaxed) % Slots;
+        return slot;
+    }
+
+public:
+    class Guard
+    {
+        std::atomic<uint64_t>* counter;
+    public:
+        explicit Guard(EpochDomain& domain)
+        {
+            uint64_t e = domain.epoch.load(std::memory_order_seq_cst);
+            counter = &domain.slots[thread_slot()].readers[e & 1];
+            counter->fetch_add(1, std::memory_order_seq_cst);
+        }
+        Guard(Guard&& o) : counter(o.counter)
+        {
+            o.counter = nullptr;
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator= (const Guard&) = delete;
+        ~Guard()
+        {
+            if (counter != nullptr) {
+                counter->fetch_sub(1, std::memory_order_release);
+            }
+        }
+    };
+
+    EpochDomain() : epoch(0)
+    {
+        for (auto& slot : slots) {
+            slot.readers[0].store(0, std::memory_order_relaxed);
+            slot.readers[1].store(0, std::memory_order_relaxed);
+        }
+    }
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator= (const EpochDomain&) = delete;
+
+    //wait until every reader that started before the call has finished
+    //the calling thread must not hold a Guard of this domain
+    void synchronize()
+    {
+        for (int phase = 0; phase < 2; phase++) {
+            uint64_t e = epoch.fetch_add(1, std::memory_order_seq_cst);
+            //seq_cst like the increments of the readers, so a reader that read the old epoch is
+            //either seen here or sees the new epoch and the unlinked arrays are out of its reach
+            for (auto& slot : slots) {
+                while (slot.readers[e & 1].load(std::memory_order_seq_cst) != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+};
+
+} //namespace jzt::detail::qp
+
+} //namespace jzt::detail
+
+namespace qp {
+
+//a trie for one writer and any number of concurrent readers
+//readers take no locks and never wait: they pin an epoch and walk twig arrays that are never
+//modified once published. the writer copies the arrays on the path from the root to the change,
+//swaps the root pointer, and frees the old arrays after a grace period
+//writers are serialized by a mutex
+template <typename DataType, bool IsMap, unsigned Bits = 4>
+class ConcurrentTrie
+{
+private:
+    using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
+    using NodeType = jzt::detail::qp::Node<DataType, IsMap, Bits>;
+    using BranchType = jzt::detail::qp::Branch<DataType, IsMap, Bits>;
+    using PoolType = jzt::detail::qp::TwigPool<NodeType>;
+    using FanoutType = jzt::detail::qp::Fanout<Bits>;
+    using TwigIndexType = jzt::detail::qp::TwigIndexType;
+    using NybbleType = jzt::detail::qp::NybbleType;
+    using NybbleIndexType = jzt::detail::qp::NybbleIndexType;
+    static constexpr NybbleType NybbleHead = jzt::detail::qp::NybbleHead;
+
+    static_assert(std::is_copy_constructible_v<DataType>, "DataType must be copy constructible, the writer copies leaves");
+
+public:
+    using ConstIteratorType = ConstIterator<NodeType>;
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+    //retired twig arrays collected before a grace period is run
+    static constexpr std::size_t RetireBatch = 4096;
+
+private:
+    struct Step
+    {
+        NodeType* node; //a branch on the path
+        TwigIndexType idx; //the twig the path takes
+    };
+    struct Retired
+    {
+        NodeType* twigs;
+        TwigIndexType size;
+    };
+
+    std::mutex writer;
+    PoolType pool;
+    //a one twig array holding the root node, nullptr when the trie is empty
+    //every twig array of a ConcurrentTrie is allocated at its exact size
+    std::atomic<NodeType*> root;
+    mutable jzt::detail::qp::EpochDomain epochs;
+    std::vector<Step> path;
+    std::vector<Retired> retired;
+
+    //leaves are copied since readers may still use the old ones, branches share their twig array
+    static NodeType copy_of(NodeType* src)
+    {
+        if (src->is_leaf()) {
+            return NodeType(LeafType(src->get_leaf()));
+        }
+        auto& branch = src->get_branch();
+        return NodeType(BranchType(branch.nybble_index(), branch.has_head(), branch.twig_bitmap(), branch.twig(0), branch.twig_count()));
+    }
+    void retire(BranchType& branch)
+    {
+        retired.push_back({branch.twig(0), branch.twig_count()});
+    }
+    void free_retired()
+    {
+        for (auto& r : retired) {
+            for (TwigIndexType i = 0; i < r.size; i++) {
+                r.twigs[i].~NodeType(); //only leaves are owned by the array
+            }
+            pool.deallocate(r.twigs, r.size);
+        }
+        retired.clear();
+    }
+    void collect()
+    {
+        if (retired.size() < RetireBatch) {
+            return;
+        }
+        epochs.synchronize();
+        free_retired();
+    }
+    //value replaces the twig at the end of path, the arrays above it are copied and a new root is
+    //published. an empty value removes that twig's slot altogether (only possible at the root)
+    void publish(std::optional<NodeType>& value)
+    {
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            auto& branch = it->node->get_branch();
+            TwigIndexType size = branch.twig_count();
+            NodeType* twigs = pool.allocate(size);
+            for (TwigIndexType i = 0; i < size; i++) {
+                if (i == it->idx) {
+                    new (&twigs[i]) NodeType(std::move(*value));
+                } else {
+                    new (&twigs[i]) NodeType(copy_of(branch.twig(i)));
+                }
+            }
+            value.emplace(BranchType(branch.nybble_index(), branch.has_head(), branch.twig_bitmap(), twigs, size));
+            retire(branch);
+        }
+        NodeType* cell = nullptr;
+        if (value) {
+            cell = pool.allocate(1);
+            new (cell) NodeType(std::move(*value));
+            value.reset();
+        }
+        NodeType* old = root.exchange(cell, std::memory_order_seq_cst);
+        if (old != nullptr) {
+            retired.push_back({old, 1});
+        }
+        path.clear();
+        collect();
+    }
+    void clear_root()
+    {
+        free_retired();
+        NodeType* cell = root.load(std::memory_order_relaxed);
+        if (cell == nullptr) {
+            return;
+        }
+        if constexpr (!std::is_trivially_destructible_v<DataType>) {
+            cell->destroy(pool);
+        }
+        cell->~NodeType();
+        pool.deallocate(cell, 1);
+        root.store(nullptr, std::memory_order_relaxed);
+    }
+
+public:
+    //a consistent view of the trie as it was when the handle was taken
+    //nodes reached through it stay valid until the handle is destroyed, the writer thread must not
+    //hold one while it writes
+    class ReadHandle
+    {
+        jzt::detail::qp::EpochDomain::Guard guard;
+        NodeType* root;
+    public:
+        explicit ReadHandle(const ConcurrentTrie& trie) : guard(trie.epochs), root(trie.root.load(std::memory_order_seq_cst)) {}
+
+        ConstIteratorType begin() const
+        {
+            if (root == nullptr) {
+                return {};
+            }
+            return ConstIteratorType(root);
+        }
+        ConstIteratorType end() const
+        {
+            return ConstIteratorType(root, nullptr);
+        }
+        template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+        ConstIteratorType find(const T& key) const
+        {
+            if (root == nullptr) {
+                return {};
+            }
+            NodeType* node = root->find(std::string_view(key));
+            if (node == nullptr) return {};
+            return ConstIteratorType(root, node);
+        }
+        template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+        ConstIteratorType prefix(const T& prefix) const
+        {
+            if (root == nullptr) {
+                return {};
+            }
+            TwigIndexType first, last;
+            NodeType* node = root->get_prefix(std::string_view(prefix), first, last);
+            if (node == nullptr) return {};
+            if (node->is_leaf()) return ConstIteratorType(node);
+            return ConstIteratorType(node, first, last);
+        }
+        template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+        bool contains(const T& key) const
+        {
+            return root != nullptr && root->contains(std::string_view(key));
+        }
+        template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+        bool contains_prefix(const T& prefix) const
+        {
+            return root != nullptr && root->contains_prefix(std::string_view(prefix));
+        }
+    };
+
+    ConcurrentTrie() : root(nullptr) {}
+    explicit ConcurrentTrie(const allocator_type& alloc) : pool(alloc.resource()), root(nullptr) {}
+    ConcurrentTrie(const ConcurrentTrie&) = delete;
+    ConcurrentTrie& operator= (const ConcurrentTrie&) = delete;
+    //no reader may be active
+    ~ConcurrentTrie()
+    {
+        clear_root();
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(pool.resource());
+    }
+
+    ReadHandle read() const
+    {
+        return ReadHandle(*this);
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains(const T& key) const
+    {
+        return read().contains(key);
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains_prefix(const T& prefix) const
+    {
+        return read().contains_prefix(prefix);
+    }
+
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<LeafType, Args...>, bool> = true>
+    bool emplace(Args&&... args)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        LeafType new_leaf(std::forward<Args>(args)...);
+        std::string_view key = new_leaf.key_view();
+        std::optional<NodeType> value;
+        NodeType* cell = root.load(std::memory_order_relaxed);
+        if (cell == nullptr) {
+            value.emplace(std::move(new_leaf));
+            publish(value);
+            return true;
+        }
+        NodeType* similar = cell->find_similar(key);
+        std::string_view similar_key = similar->get_leaf().key_view();
+        auto ni_opt = FanoutType::find_mismatch(similar_key, key);
+        if (!ni_opt) {
+            return false;
+        }
+        NybbleIndexType ni = *ni_opt;
+        NodeType* node = cell;
+        while (node->is_branch() && node->get_branch().nybble_index() < ni) {
+            auto& branch = node->get_branch();
+            TwigIndexType idx = branch.twig_index(branch.twig_nybble(key));
+            path.push_back({node, idx});
+            node = branch.twig(idx);
+        }
+        NybbleType n = FanoutType::nybble_at(key, ni);
+        if (node->is_branch() && node->get_branch().nybble_index() == ni) {
+            auto& branch = node->get_branch();
+            TwigIndexType size = branch.twig_count();
+            TwigIndexType idx = (n == NybbleHead) ? 0 : branch.twig_index(n);
+            auto bitmap = (n == NybbleHead) ? branch.twig_bitmap() : FanoutType::with(branch.twig_bitmap(), n);
+            NodeType* twigs = pool.allocate(size + 1);
+            for (TwigIndexType i = 0; i < idx; i++) {
+                new (&twigs[i]) NodeType(copy_of(branch.twig(i)));
+            }
+            new (&twigs[idx]) NodeType(std::move(new_leaf));
+            for (TwigIndexType i = idx; i < size; i++) {
+                new (&twigs[i + 1]) NodeType(copy_of(branch.twig(i)));
+            }
+            value.emplace(BranchType(ni, branch.has_head() || n == NybbleHead, bitmap, twigs, size + 1));
+            retire(branch);
+        } else {
+            //a new branch at ni takes the new leaf and the subtree that was here
+            NybbleType old_n = FanoutType::nybble_at(similar_key, ni);
+            bool leaf_first = (n == NybbleHead) || (old_n != NybbleHead && n < old_n);
+            typename BranchType::Bitmap bitmap{};
+            if (n != NybbleHead) {
+                bitmap = FanoutType::with(bitmap, n);
+            }
+            if (old_n != NybbleHead) {
+                bitmap = FanoutType::with(bitmap, old_n);
+            }
+            NodeType* twigs = pool.allocate(2);
+            new (&twigs[leaf_first ? 1 : 0]) NodeType(copy_of(node));
+            new (&twigs[leaf_first ? 0 : 1]) NodeType(std::move(new_leaf));
+            value.emplace(BranchType(ni, n == NybbleHead || old_n == NybbleHead, bitmap, twigs, 2));
+        }
+        publish(value);
+        return true;
+    }
+
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool remove(const T& k)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        std::string_view key(k);
+        NodeType* node = root.load(std::memory_order_relaxed);
+        if (node == nullptr) {
+            return false;
+        }
+        while (node->is_branch()) {
+            auto& branch = node->get_branch();
+            NybbleType n = branch.twig_nybble(key);
+            if (n == NybbleHead ? !branch.has_head() : !branch.has_twig(n)) {
+                path.clear();
+                return false;
+            }
+            TwigIndexType idx = (n == NybbleHead) ? 0 : branch.twig_index(n);
+            path.push_back({node, idx});
+            node = branch.twig(idx);
+        }
+        if (!node->get_leaf().key_equal(key)) {
+            path.clear();
+            return false;
+        }
+        std::optional<NodeType> value;
+        if (!path.empty()) {
+            Step step = path.back();
+            path.pop_back();
+            auto& branch = step.node->get_branch();
+            TwigIndexType size = branch.twig_count();
+            if (size > 2) {
+                NybbleType n = branch.twig_nybble(key);
+                auto bitmap = (n == NybbleHead) ? branch.twig_bitmap() : FanoutType::without(branch.twig_bitmap(), n);
+                NodeType* twigs = pool.allocate(size - 1);
+                for (TwigIndexType i = 0, j = 0; i < size; i++) {
+                    if (i != step.idx) {
+                        new (&twigs[j++]) NodeType(copy_of(branch.twig(i)));
+                    }
+                }
+                value.emplace(BranchType(branch.nybble_index(), branch.has_head() && n != NybbleHead, bitmap, twigs, size - 1));
+            } else {
+                //the branch is replaced by its other twig
+                value.emplace(copy_of(branch.twig(step.idx == 0 ? 1 : 0)));
+            }
+            retire(branch);
+        }
+        publish(value);
+        return true;
+    }
+
+    //free every retired twig array now, waits for the readers that are still running
+    void synchronize()
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        epochs.synchronize();
+        free_retired();
+    }
+};
+
+//a trie for many concurrent writers
+//every top-level twig of the root branch has its own lock and twig pool, so writes under different
+//top-level twigs run in parallel while holding the root lock shared. a write that changes the root
+//branch itself (a new twig or head there, a key diverging at or above its nybble, removing a
+//top-level leaf, or any change while the root is a leaf) takes the root lock exclusively
+template <typename DataType, bool IsMap, unsigned Bits = 4>
+class StripedTrie
+{
+private:
+    using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
+    using NodeType = jzt::detail::qp::Node<DataType, IsMap, Bits>;
+    using PoolType = jzt::detail::qp::TwigPool<NodeType>;
+    using FanoutType = jzt::detail::qp::Fanout<Bits>;
+    using NybbleType = jzt::detail::qp::NybbleType;
+    static constexpr NybbleType NybbleHead = jzt::detail::qp::NybbleHead;
+
+public:
+    using IteratorType = Iterator<NodeType>;
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+private:
+    struct alignas(64) Stripe
+    {
+        std::shared_mutex mutex;
+        PoolType pool;
+    };
+
+    //the pools grow concurrently, twig arrays may be returned to any of them since every chunk lives
+    //until the trie is destroyed
+    jzt::detail::qp::LockedResource shared;
+    PoolType root_pool;
+    Stripe stripes[1 << Bits];
+    std::shared_mutex root_lock;
+    std::optional<NodeType> root;
+
+    //runs f on the leaf of key under the shared root lock and the shared lock of its top-level twig
+    template <typename F>
+    bool find_locked(std::string_view key, F&& f)
+    {
+        std::shared_lock<std::shared_mutex> lock(root_lock);
+        if (!root) {
+            return false;
+        }
+        NodeType* node = &(root.value());
+        std::shared_lock<std::shared_mutex> stripe_lock;
+        if (node->is_branch()) {
+            auto& branch = node->get_branch();
+            NybbleType n = branch.twig_nybble(key);
+            if (n == NybbleHead) {
+                if (!branch.has_head()) {
+                    return false;
+                }
+                node = branch.get_head();
+            } else {
+                if (!branch.has_twig(n)) {
+                    return false;
+                }
+                stripe_lock = std::shared_lock<std::shared_mutex>(stripes[n].mutex);
+                node = branch.twig(branch.twig_index(n));
+            }
+        }
+        node = node->find(key);
+        if (node == nullptr) {
+            return false;
+        }
+        f(node->get_leaf().get_data());
+        return true;
+    }
+
+public:
+    StripedTrie() : StripedTrie(allocator_type()) {}
+    explicit StripedTrie(const allocator_type& alloc) : shared(alloc.resource()), root_pool(&shared)
+    {
+        for (auto& stripe : stripes) {
+            stripe.pool = PoolType(&shared);
+        }
+    }
+    StripedTrie(const StripedTrie&) = delete;
+    StripedTrie& operator= (const StripedTrie&) = delete;
+    //no other thread may use the trie
+    ~StripedTrie()
+    {
+        if constexpr (!std::is_trivially_destructible_v<DataType>) {
+            if (root) {
+                root->destroy(root_pool);
+            }
+        }
+        root.reset();
+    }
+
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<LeafType, Args...>, bool> = true>
+    bool emplace(Args&&... args)
+    {
+        LeafType new_leaf(std::forward<Args>(args)...);
+        std::string_view key = new_leaf.key_view();
+        {
+            std::shared_lock<std::shared_mutex> lock(root_lock);
+            if (root && root->is_branch()) {
+                auto& branch = root->get_branch();
+                NybbleType n = branch.twig_nybble(key);
+                if (n != NybbleHead && branch.has_twig(n)) {
+                    Stripe& stripe = stripes[n];
+                    std::unique_lock<std::shared_mutex> stripe_lock(stripe.mutex);
+                    NodeType* twig = branch.twig(branch.twig_index(n));
+                    auto ni_opt = FanoutType::find_mismatch(twig->find_similar(key)->get_leaf().key_view(), key);
+                    if (!ni_opt) {
+                        return false;
+                    }
+                    //otherwise the key leaves the twig above the root nybble
+                    if (*ni_opt > branch.nybble_index()) {
+                        return twig->emplace(stripe.pool, std::move(new_leaf));
+                    }
+                }
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(root_lock);
+        if (!root) {
+            root.emplace(std::move(new_leaf));
+            return true;
+        }
+        return root->emplace(root_pool, std::move(new_leaf));
+    }
+
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool remove(const T& k)
+    {
+        std::string_view key(k);
+        {
+            std::shared_lock<std::shared_mutex> lock(root_lock);
+            if (!root) {
+                return false;
+            }
+            if (root->is_branch()) {
+                auto& branch = root->get_branch();
+                NybbleType n = branch.twig_nybble(key);
+                if (n != NybbleHead) {
+                    if (!branch.has_twig(n)) {
+                        return false;
+                    }
+                    Stripe& stripe = stripes[n];
+                    std::unique_lock<std::shared_mutex> stripe_lock(stripe.mutex);
+                    NodeType* twig = branch.twig(branch.twig_index(n));
+                    //a branch twig collapses into its remaining twig in place
+                    if (twig->is_branch()) {
+                        return twig->remove(stripe.pool, key).first;
+                    }
+                    if (!twig->get_leaf().key_equal(key)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(root_lock);
+        if (!root) {
+            return false;
+        }
+        auto ret = root->remove(root_pool, key);
+        if (!ret.first) return false;
+        if (ret.second) {
+            root.reset();
+        }
+        return true;
+    }
+
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains(const T& key)
+    {
+        return find_locked(std::string_view(key), [](const DataType&) {});
+    }
+    //f gets the element of key while its top-level twig is locked for reading
+    template <typename T, typename F, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool visit(const T& key, F&& f)
+    {
+        return find_locked(std::string_view(key), [&](const DataType& data) { f(data); });
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains_prefix(const T& p)
+    {
+        std::string_view prefix(p);
+        {
+            std::shared_lock<std::shared_mutex> lock(root_lock);
+            if (!root) {
+                return false;
+            }
+            if (root->is_leaf()) {
+                return root->contains_prefix(prefix);
+            }
+            auto& branch = root->get_branch();
+            if (branch.nybble_index() < FanoutType::nybbles_in(prefix.size())) {
+                NybbleType n = branch.twig_nybble(prefix);
+                if (!branch.has_twig(n)) {
+                    return false;
+                }
+                std::shared_lock<std::shared_mutex> stripe_lock(stripes[n].mutex);
+                return branch.twig(branch.twig_index(n))->contains_prefix(prefix);
+            }
+        }
+        //prefix spans several top-level twigs
+        std::unique_lock<std::shared_mutex> lock(root_lock);
+        return root && root->contains_prefix(prefix);
+    }
+    //f gets every element in key order, all writers are blocked meanwhile
+    template <typename F>
+    void for_each(F&& f)
+    {
+        std::unique_lock<std::shared_mutex> lock(root_lock);
+        if (!root) {
+            return;
+        }
+        for (IteratorType it(&(root.value())), end; it != end; ++it) {
+            f(*it);
+        }
+    }
+};
+
+} //namespace jzt::qp
+} //namespace jzt
+
+#endif // CONCURRENT_TRIE_HPP
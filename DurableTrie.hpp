@@ -0,0 +1,663 @@
+#ifndef DURABLE_TRIE_HPP
+#define DURABLE_TRIE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Trie.hpp"
+#include "MappedTrie.hpp"
+
+//directory layout:
+//  wal.<n>         log records, n is the sequence number of the first one, records are numbered from 1
+//  checkpoint.<n>  an image written by write_mapped holding every record up to n
+//a record is op, key size as a varint, key bytes, the mapped value (insertions into maps only)
+//and the crc32c of all of that. on startup the newest checkpoint is loaded and the records after
+//it are replayed, a torn record at the end of the last log is cut off
+
+namespace jzt {
+
+namespace detail {
+
+namespace qp {
+
+enum class LogOp : uint8_t
+{
+    Insert = 1,
+    Remove = 2,
+};
+
+struct Crc32c
+{
+    static const std::array<uint32_t, 256>& table()
+    {
+        static const std::array<uint32_t, 256> t = [] {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        return t;
+    }
+    static uint32_t compute(const char* p, std::size_t n)
+    {
+        const auto& t = table();
+        uint32_t c = 0xFFFFFFFF;
+        for (std::size_t i = 0; i < n; i++) {
+            c = t[(c ^ (uint8_t)p[i]) & 0xFF] ^ (c >> 8);
+        }
+        return ~c;
+    }
+};
+
+//zero padded so that names sort like their numbers
+inline std::string durable_file_name(const char* kind, uint64_t n)
+{
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "%s.%020llu", kind, (unsigned long long)n);
+    return buf;
+}
+
+inline bool parse_durable_file_name(const std::string& name, const char* kind, uint64_t& n)
+{
+    std::size_t len = std::strlen(kind);
+    if (name.size() != len + 21 || name.compare(0, len, kind) != 0 || name[len] != '.') {
+        return false;
+    }
+    n = 0;
+    for (std::size_t i = len + 1; i < name.size(); i++) {
+        if (name[i] < '0' || name[i] > '9') {
+            return false;
+        }
+        n = n * 10 + (name[i] - '0');
+    }
+    return true;
+}
+
+//fsync a file or a directory
+inline void sync_path(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        int err = errno;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::system_error(err, std::generic_category(), "sync failed " + path);
+    }
+    ::close(fd);
+}
+
+//group commit: records are appended to a buffer under the mutex, the first committer that finds
+//no flush running writes and syncs everything appended so far, the others wait for it and
+//usually find their records already on disk
+class WriteAheadLog
+{
+    std::string dir;
+    std::mutex mutex;
+    std::condition_variable flushed;
+    std::string buffer;
+    uint64_t last; //number of the last appended record
+    uint64_t durable; //number of the last record on disk
+    std::size_t bytes; //size of the current file including the buffer
+    bool flushing;
+    int error;
+    int fd;
+
+    static int write_all(int fd, const std::string& data)
+    {
+        std::size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            done += n;
+        }
+        if (!data.empty() && ::fdatasync(fd) != 0) {
+            return errno;
+        }
+        return 0;
+    }
+    int open_file(uint64_t first)
+    {
+        std::string path = dir + "/" + durable_file_name("wal", first);
+        int f = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (f < 0) {
+            return -1;
+        }
+        int d = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if (d < 0 || ::fsync(d) != 0) {
+            int err = errno;
+            if (d >= 0) {
+                ::close(d);
+            }
+            ::close(f);
+            errno = err;
+            return -1;
+        }
+        ::close(d);
+        return f;
+    }
+    void check()
+    {
+        if (error != 0) {
+            throw std::system_error(error, std::generic_category(), "WriteAheadLog: write failed in " + dir);
+        }
+    }
+    //called with the lock held and no flush running, the lock is dropped during the I/O
+    //with rotate the records go to the current file and later ones to a new file
+    void lead(std::unique_lock<std::mutex>& lock, bool rotate)
+    {
+        flushing = true;
+        std::string data;
+        data.swap(buffer);
+        uint64_t target = last;
+        int out = fd;
+        lock.unlock();
+        int err = write_all(out, data);
+        int next = -1;
+        if (err == 0 && rotate) {
+            next = open_file(target + 1);
+            if (next < 0) {
+                err = errno;
+            }
+        }
+        lock.lock();
+        flushing = false;
+        if (err == 0) {
+            durable = target;
+            if (rotate) {
+                ::close(fd);
+                fd = next;
+                bytes = buffer.size();
+            }
+        } else {
+            error = err;
+        }
+        flushed.notify_all();
+        check();
+    }
+
+public:
+    //records continue after last in a new file
+    WriteAheadLog(const std::string& d, uint64_t l) : dir(d), last(l), durable(l), bytes(0), flushing(false), error(0)
+    {
+        fd = open_file(last + 1);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "WriteAheadLog: cannot create a log in " + dir);
+        }
+    }
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator= (const WriteAheadLog&) = delete;
+    ~WriteAheadLog()
+    {
+        ::close(fd);
+    }
+
+    //the number of the record, it is durable once commit returns for it
+    uint64_t append(std::string_view record)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        check();
+        buffer.append(record);
+        bytes += record.size();
+        return ++last;
+    }
+    void commit(uint64_t n)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (durable < n) {
+            check();
+            if (flushing) {
+                flushed.wait(lock);
+                continue;
+            }
+            lead(lock, false);
+        }
+    }
+    //syncs the current file and starts a new one, returns the number of the last record in the old file
+    uint64_t rotate()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        flushed.wait(lock, [this] { return !flushing; });
+        check();
+        uint64_t target = last;
+        lead(lock, true);
+        return target;
+    }
+    uint64_t last_record()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return last;
+    }
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytes;
+    }
+};
+
+} //namespace jzt::detail::qp
+
+} //namespace jzt::detail
+
+namespace qp {
+
+//a Trie kept in a directory: every successful emplace and remove is logged and synced before it
+//returns, concurrent writers share their syncs. a checkpoint runs in the background once the log
+//grows past checkpoint_bytes, it writes a snapshot while readers and writers go on, and the logs
+//it covers are deleted. the mapped_type of a map must be trivially copyable, see MappedTrie
+//writers are serialized, readers run concurrently with each other. a write whose logging fails has
+//already changed the trie, so it throws and leaves the trie failed: every later call throws as well
+//and only what was synced before is recovered by reopening the directory
+template <typename DataType, bool IsMap, unsigned Bits = 4>
+class DurableTrie
+{
+private:
+    using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
+    using TrieType = Trie<DataType, IsMap, Bits>;
+    using MappedType = MappedTrie<DataType, IsMap, Bits>;
+    using LogOp = jzt::detail::qp::LogOp;
+    using key_type = typename LeafType::key_type;
+    using mapped_type = typename LeafType::mapped_type;
+
+    static_assert(std::is_constructible_v<key_type, std::string_view>, "key_type must own its bytes to be recovered");
+    static_assert(std::is_copy_constructible_v<DataType>, "DataType must be copy constructible to take checkpoints");
+
+    //the elements of a checkpoint as an input range for build_sorted
+    class Elements
+    {
+        typename MappedType::Iterator it;
+
+    public:
+        explicit Elements(typename MappedType::Iterator i) : it(std::move(i)) {}
+        DataType operator*() const
+        {
+            if constexpr (IsMap) {
+                return DataType(key_type(it.key()), it.value());
+            } else {
+                return DataType(it.key());
+            }
+        }
+        Elements& operator++()
+        {
+            ++it;
+            return *this;
+        }
+        bool operator!=(const Elements& rhs) const
+        {
+            return it != rhs.it;
+        }
+    };
+
+    std::string dir;
+    std::size_t checkpoint_bytes;
+    std::shared_mutex trie_lock;
+    TrieType trie;
+    std::optional<jzt::detail::qp::WriteAheadLog> log;
+    bool failed; //guarded by trie_lock
+
+    std::mutex checkpoint_lock; //one checkpoint at a time
+    std::mutex state_lock;
+    std::condition_variable state_changed;
+    bool checkpoint_pending;
+    bool stopping;
+    std::exception_ptr checkpoint_error;
+    std::thread checkpointer;
+
+    static std::string make_record(LogOp op, std::string_view key, const mapped_type* value)
+    {
+        std::string record;
+        record.reserve(key.size() + 20);
+        record.push_back((char)op);
+        for (uint64_t n = key.size(); ; n >>= 7) {
+            if (n < 0x80) {
+                record.push_back((char)n);
+                break;
+            }
+            record.push_back((char)(0x80 | (n & 0x7F)));
+        }
+        record.append(key);
+        if (value != nullptr) {
+            record.append(reinterpret_cast<const char*>(value), sizeof(mapped_type));
+        }
+        uint32_t crc = jzt::detail::qp::Crc32c::compute(record.data(), record.size());
+        record.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+        return record;
+    }
+    //applies the record at data[pos] when apply is set, returns its end or npos when it is torn or corrupt
+    std::size_t replay_record(const std::string& data, std::size_t pos, bool apply)
+    {
+        std::size_t p = pos;
+        if (p >= data.size()) {
+            return std::string::npos;
+        }
+        LogOp op = (LogOp)data[p++];
+        if (op != LogOp::Insert && op != LogOp::Remove) {
+            return std::string::npos;
+        }
+        uint64_t size = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            if (p >= data.size() || shift > 63) {
+                return std::string::npos;
+            }
+            uint8_t b = data[p++];
+            size |= (uint64_t)(b & 0x7F) << shift;
+            if (b < 0x80) {
+                break;
+            }
+        }
+        std::size_t value_size = (IsMap && op == LogOp::Insert) ? sizeof(mapped_type) : 0;
+        if (size > data.size() || data.size() - p < size + value_size + sizeof(uint32_t)) {
+            return std::string::npos;
+        }
+        std::string_view key(data.data() + p, size);
+        p += size + value_size;
+        uint32_t crc;
+        std::memcpy(&crc, data.data() + p, sizeof(crc));
+        if (crc != jzt::detail::qp::Crc32c::compute(data.data() + pos, p - pos)) {
+            return std::string::npos;
+        }
+        if (!apply) {
+            //already in the checkpoint
+        } else if (op == LogOp::Remove) {
+            trie.remove(key);
+        } else if constexpr (IsMap) {
+            //trivially copyable but maybe not default constructible, the logged bytes are the value
+            alignas(mapped_type) unsigned char bytes[sizeof(mapped_type)];
+            std::memcpy(bytes, key.data() + key.size(), sizeof(mapped_type));
+            trie.emplace(key_type(key), *std::launder(reinterpret_cast<const mapped_type*>(bytes)));
+        } else {
+            trie.emplace(key_type(key));
+        }
+        return p + sizeof(crc);
+    }
+    //loads the newest checkpoint and replays the logs after it, returns the number of the last record
+    uint64_t recover()
+    {
+        namespace fs = std::filesystem;
+        std::map<uint64_t, std::string> checkpoints, logs;
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            std::string name = entry.path().filename().string();
+            uint64_t n;
+            if (jzt::detail::qp::parse_durable_file_name(name, "checkpoint", n)) {
+                checkpoints[n] = entry.path().string();
+            } else if (jzt::detail::qp::parse_durable_file_name(name, "wal", n)) {
+                logs[n] = entry.path().string();
+            } else if (name == "checkpoint.tmp") {
+                fs::remove(entry.path());
+            }
+        }
+        uint64_t last = 0;
+        if (!checkpoints.empty()) {
+            auto& [n, path] = *checkpoints.rbegin();
+            MappedType image(path);
+            trie.build_sorted(Elements(image.begin()), Elements(image.end()));
+            last = n;
+        }
+        for (auto it = logs.begin(); it != logs.end(); ++it) {
+            uint64_t first = it->first;
+            bool tail = std::next(it) == logs.end();
+            std::ifstream is(it->second, std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+            if (!is.eof() && is.fail()) {
+                throw std::runtime_error("DurableTrie: cannot read " + it->second);
+            }
+            if (first > last + 1 && !data.empty()) {
+                throw std::runtime_error("DurableTrie: records before " + it->second + " are missing");
+            }
+            std::size_t pos = 0;
+            for (uint64_t n = first; pos < data.size(); n++) {
+                std::size_t end = replay_record(data, pos, n > last);
+                if (end == std::string::npos) {
+                    break;
+                }
+                last = std::max(last, n);
+                pos = end;
+            }
+            if (pos < data.size()) {
+                //only the last log may end in a record that was being written
+                if (!tail) {
+                    throw std::runtime_error("DurableTrie: corrupt record in " + it->second);
+                }
+                fs::resize_file(it->second, pos);
+                jzt::detail::qp::sync_path(it->second);
+            }
+        }
+        return last;
+    }
+    void check_failed() const
+    {
+        if (failed) {
+            throw std::runtime_error("DurableTrie: a write failed to reach the log, reopen to recover");
+        }
+    }
+    void take_checkpoint()
+    {
+        namespace fs = std::filesystem;
+        std::lock_guard<std::mutex> guard(checkpoint_lock);
+        //everything logged before the snapshot is in closed files that can go once it is written
+        uint64_t covered = log->rotate();
+        typename TrieType::SnapshotType snap;
+        uint64_t last;
+        {
+            std::unique_lock<std::shared_mutex> lock(trie_lock);
+            //the trie holds writes the log does not, they must not reach a checkpoint either
+            check_failed();
+            snap = trie.snapshot();
+            last = log->last_record();
+        }
+        std::string tmp = dir + "/checkpoint.tmp";
+        write_mapped(snap, tmp);
+        snap = {};
+        jzt::detail::qp::sync_path(tmp);
+        fs::rename(tmp, dir + "/" + jzt::detail::qp::durable_file_name("checkpoint", last));
+        jzt::detail::qp::sync_path(dir);
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            std::string name = entry.path().filename().string();
+            uint64_t n;
+            if ((jzt::detail::qp::parse_durable_file_name(name, "checkpoint", n) && n < last)
+                || (jzt::detail::qp::parse_durable_file_name(name, "wal", n) && n <= covered)) {
+                fs::remove(entry.path());
+            }
+        }
+    }
+    void run_checkpoints()
+    {
+        std::unique_lock<std::mutex> lock(state_lock);
+        for (;;) {
+            state_changed.wait(lock, [this] { return stopping || checkpoint_pending; });
+            if (stopping) {
+                return;
+            }
+            lock.unlock();
+            try {
+                take_checkpoint();
+            } catch (...) {
+                std::lock_guard<std::mutex> error_lock(state_lock);
+                checkpoint_error = std::current_exception();
+            }
+            lock.lock();
+            checkpoint_pending = false;
+        }
+    }
+    //the trie already holds the change of a record that is appended, a log that fails after it fails the trie
+    uint64_t append(const std::string& record)
+    {
+        try {
+            return log->append(record);
+        } catch (...) {
+            failed = true;
+            throw;
+        }
+    }
+    void committed(uint64_t n)
+    {
+        try {
+            log->commit(n);
+        } catch (...) {
+            std::unique_lock<std::shared_mutex> lock(trie_lock);
+            failed = true;
+            throw;
+        }
+        if (checkpoint_bytes != 0 && log->size() >= checkpoint_bytes) {
+            std::lock_guard<std::mutex> lock(state_lock);
+            if (!checkpoint_pending) {
+                checkpoint_pending = true;
+                state_changed.notify_one();
+            }
+        }
+    }
+
+public:
+    //opens or creates dir and recovers its contents, 0 disables background checkpoints
+    explicit DurableTrie(const std::string& d, std::size_t cb = 64 << 20)
+        : dir(d), checkpoint_bytes(cb), failed(false), checkpoint_pending(false), stopping(false)
+    {
+        std::filesystem::create_directories(dir);
+        log.emplace(dir, recover());
+        checkpointer = std::thread([this] { run_checkpoints(); });
+    }
+    DurableTrie(const DurableTrie&) = delete;
+    DurableTrie& operator= (const DurableTrie&) = delete;
+    //waits for a running checkpoint, no other thread may use the trie
+    ~DurableTrie()
+    {
+        {
+            std::lock_guard<std::mutex> lock(state_lock);
+            stopping = true;
+        }
+        state_changed.notify_one();
+        checkpointer.join();
+    }
+
+    //returns once the insertion is durable, false when the key is already there
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<LeafType, Args...>, bool> = true>
+    bool emplace(Args&&... args)
+    {
+        LeafType new_leaf(std::forward<Args>(args)...);
+        const mapped_type* value = nullptr;
+        if constexpr (IsMap) {
+            value = &(new_leaf.get_data().second);
+        }
+        std::string record = make_record(LogOp::Insert, new_leaf.key_view(), value);
+        uint64_t n;
+        {
+            std::unique_lock<std::shared_mutex> lock(trie_lock);
+            check_failed();
+            if (!trie.emplace(std::move(new_leaf))) {
+                return false;
+            }
+            n = append(record);
+        }
+        committed(n);
+        return true;
+    }
+    //returns once the removal is durable
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool remove(const T& k)
+    {
+        std::string_view key(k);
+        std::string record = make_record(LogOp::Remove, key, nullptr);
+        uint64_t n;
+        {
+            std::unique_lock<std::shared_mutex> lock(trie_lock);
+            check_failed();
+            if (!trie.remove(key)) {
+                return false;
+            }
+            n = append(record);
+        }
+        committed(n);
+        return true;
+    }
+    //writes a checkpoint on the calling thread, rethrows the error of a failed background checkpoint
+    void checkpoint()
+    {
+        {
+            std::lock_guard<std::mutex> lock(state_lock);
+            if (checkpoint_error) {
+                std::exception_ptr e = std::exchange(checkpoint_error, nullptr);
+                std::rethrow_exception(e);
+            }
+        }
+        take_checkpoint();
+    }
+
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains(const T& key)
+    {
+        std::shared_lock<std::shared_mutex> lock(trie_lock);
+        check_failed();
+        return trie.contains(key);
+    }
+    //f gets the element of key as const DataType& while the trie is locked for reading, changes
+    //would bypass the log
+    template <typename T, typename F, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool visit(const T& key, F&& f)
+    {
+        std::shared_lock<std::shared_mutex> lock(trie_lock);
+        check_failed();
+        const TrieType& t = std::as_const(trie);
+        auto it = t.find(key);
+        if (it == t.cend()) {
+            return false;
+        }
+        f(*it);
+        return true;
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains_prefix(const T& prefix)
+    {
+        std::shared_lock<std::shared_mutex> lock(trie_lock);
+        check_failed();
+        return trie.contains_prefix(prefix);
+    }
+    //f gets every element in key order as const DataType& while the trie is locked for reading
+    template <typename F>
+    void for_each(F&& f)
+    {
+        std::shared_lock<std::shared_mutex> lock(trie_lock);
+        check_failed();
+        for (auto it = trie.cbegin(); it != trie.cend(); ++it) {
+            f(*it);
+        }
+    }
+};
+
+} //namespace jzt::qp
+} //namespace jzt
+
+#endif // DURABLE_TRIE_HPP
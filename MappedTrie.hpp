@@ -0,0 +1,604 @@
+#ifndef MAPPED_TRIE_HPP
+#define MAPPED_TRIE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Trie.hpp"
+
+//file layout, all words in host byte order:
+//  MappedHeader, whose root slot is the root node
+//  twig arrays: the bitmap of the branch (one word, four for the 8-bit fan-out) and its twig slots
+//  leaf records: the mapped value (maps only), then the key bytes, padded to 8 bytes
+//a slot is two words. a leaf has key length << 1 and the offset of its record, a branch has
+//1 | head << 1 | size << 2 | index << 11 and the offset of its twig array. offsets count from
+//the start of the file, so the image can be mapped anywhere. children are written before their
+//parents, so the file is written front to back and only the header is patched at the end
+
+namespace jzt {
+
+namespace detail {
+
+namespace qp {
+
+struct MappedSlot
+{
+    uint64_t word;
+    uint64_t offset;
+
+    bool is_branch() const
+    {
+        return word & 1;
+    }
+    bool has_head() const
+    {
+        return (word >> 1) & 1;
+    }
+    TwigIndexType twig_count() const
+    {
+        return (word >> 2) & 0x1FF;
+    }
+    NybbleIndexType nybble_index() const
+    {
+        return word >> 11;
+    }
+    uint64_t key_size() const
+    {
+        return word >> 1;
+    }
+};
+
+struct MappedHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    uint64_t mapped_size; //sizeof(mapped_type), 0 for sets
+    uint64_t count;
+    uint64_t size; //file size
+    MappedSlot root; //valid when count > 0
+};
+
+static constexpr char MappedMagic[8] = {'q', 'p', '-', 't', 'r', 'i', 'e', '\0'};
+static constexpr uint32_t MappedVersion = 1;
+
+template <unsigned Bits>
+struct MappedBitmap
+{
+    static constexpr std::size_t words = (Bits == 8) ? 4 : 1;
+
+    static uint64_t size()
+    {
+        return words * sizeof(uint64_t);
+    }
+    template <typename Bitmap>
+    static void store(const Bitmap& bitmap, uint64_t* out)
+    {
+        if constexpr (Bits == 8) {
+            std::memcpy(out, bitmap.words, sizeof(bitmap.words));
+        } else {
+            out[0] = bitmap;
+        }
+    }
+    static typename Fanout<Bits>::Bitmap load(const char* p)
+    {
+        typename Fanout<Bits>::Bitmap bitmap;
+        if constexpr (Bits == 8) {
+            std::memcpy(bitmap.words, p, sizeof(bitmap.words));
+        } else {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            bitmap = static_cast<typename Fanout<Bits>::Bitmap>(word);
+        }
+        return bitmap;
+    }
+};
+
+template <typename DataType, bool IsMap, unsigned Bits>
+class MappedWriter
+{
+    using NodeType = Node<DataType, IsMap, Bits>;
+    using BranchType = Branch<DataType, IsMap, Bits>;
+    using LeafType = Leaf<DataType, IsMap>;
+    using mapped_type = typename LeafType::mapped_type;
+
+    static_assert(!IsMap || std::is_trivially_copyable_v<mapped_type>, "mapped_type must be trivially copyable to be mapped");
+    static_assert(!IsMap || alignof(mapped_type) <= 8, "mapped_type must not need more than 8 byte alignment");
+
+    std::ostream& os;
+    uint64_t offset;
+    uint64_t count;
+
+    void put(const void* p, std::size_t n)
+    {
+        os.write(static_cast<const char*>(p), n);
+        offset += n;
+    }
+    void pad()
+    {
+        static const char zeros[8] = {};
+        put(zeros, (8 - offset % 8) % 8);
+    }
+    MappedSlot write_leaf(NodeType* node)
+    {
+        LeafType& leaf = node->get_leaf();
+        MappedSlot slot{leaf.key_size() << 1, offset};
+        if constexpr (IsMap) {
+            put(&(leaf.get_data().second), sizeof(mapped_type));
+        }
+        put(leaf.key_view().data(), leaf.key_size());
+        pad();
+        count++;
+        return slot;
+    }
+    MappedSlot write_branch(BranchType& branch, const std::vector<MappedSlot>& slots)
+    {
+        MappedSlot slot{1 | (uint64_t)branch.has_head() << 1 | (uint64_t)branch.twig_count() << 2 | branch.nybble_index() << 11, offset};
+        uint64_t bitmap[MappedBitmap<Bits>::words];
+        MappedBitmap<Bits>::store(branch.twig_bitmap(), bitmap);
+        put(bitmap, sizeof(bitmap));
+        put(slots.data(), slots.size() * sizeof(MappedSlot));
+        return slot;
+    }
+
+public:
+    explicit MappedWriter(std::ostream& o) : os(o), offset(0), count(0) {}
+
+    void write(NodeType* root)
+    {
+        MappedHeader header{};
+        std::memcpy(header.magic, MappedMagic, sizeof(header.magic));
+        header.version = MappedVersion;
+        header.bits = Bits;
+        header.mapped_size = IsMap ? sizeof(mapped_type) : 0;
+        put(&header, sizeof(header));
+        if (root != nullptr) {
+            struct Frame
+            {
+                BranchType* branch;
+                std::vector<MappedSlot> slots;
+            };
+            std::vector<Frame> stack;
+            if (root->is_leaf()) {
+                header.root = write_leaf(root);
+            } else {
+                stack.push_back({&(root->get_branch()), {}});
+            }
+            while (!stack.empty()) {
+                Frame& frame = stack.back();
+                if (frame.slots.size() < frame.branch->twig_count()) {
+                    NodeType* twig = frame.branch->twig(frame.slots.size());
+                    if (twig->is_leaf()) {
+                        frame.slots.push_back(write_leaf(twig));
+                    } else {
+                        stack.push_back({&(twig->get_branch()), {}});
+                    }
+                    continue;
+                }
+                MappedSlot slot = write_branch(*frame.branch, frame.slots);
+                stack.pop_back();
+                if (stack.empty()) {
+                    header.root = slot;
+                } else {
+                    stack.back().slots.push_back(slot);
+                }
+            }
+        }
+        header.count = count;
+        header.size = offset;
+        os.seekp(0);
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.seekp(offset);
+        if (!os) {
+            throw std::runtime_error("write_mapped: write failed");
+        }
+    }
+};
+
+} //namespace jzt::detail::qp
+
+} //namespace jzt::detail
+
+namespace qp {
+
+//write trie in the format read by MappedTrie, os must be seekable
+template <typename DataType, bool IsMap, unsigned Bits>
+void write_mapped(const Trie<DataType, IsMap, Bits>& trie, std::ostream& os)
+{
+    jzt::detail::qp::MappedWriter<DataType, IsMap, Bits>(os).write(jzt::detail::qp::RootAccess::root(trie));
+}
+template <typename DataType, bool IsMap, unsigned Bits>
+void write_mapped(const Snapshot<DataType, IsMap, Bits>& snapshot, std::ostream& os)
+{
+    jzt::detail::qp::MappedWriter<DataType, IsMap, Bits>(os).write(jzt::detail::qp::RootAccess::root(snapshot));
+}
+template <typename Container>
+void write_mapped(const Container& trie, const std::string& path)
+{
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os) {
+        throw std::runtime_error("write_mapped: cannot open " + path);
+    }
+    write_mapped(trie, os);
+    os.close();
+    if (!os) {
+        throw std::runtime_error("write_mapped: write failed " + path);
+    }
+}
+
+//a read-only trie over a file written by write_mapped, the file is mapped and read in place
+//DataType, IsMap and Bits must match the Trie that was written. opening checks every slot of the
+//image once, O(size), and throws on a damaged one
+template <typename DataType, bool IsMap, unsigned Bits = 4>
+class MappedTrie
+{
+    using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
+    using FanoutType = jzt::detail::qp::Fanout<Bits>;
+    using BitmapType = jzt::detail::qp::MappedBitmap<Bits>;
+    using SlotType = jzt::detail::qp::MappedSlot;
+    using HeaderType = jzt::detail::qp::MappedHeader;
+    using TwigIndexType = jzt::detail::qp::TwigIndexType;
+    using NybbleType = jzt::detail::qp::NybbleType;
+    using NybbleIndexType = jzt::detail::qp::NybbleIndexType;
+    static constexpr NybbleType NybbleHead = jzt::detail::qp::NybbleHead;
+
+public:
+    using mapped_type = typename LeafType::mapped_type;
+    //keys are views into the mapping
+    using value_type = std::conditional_t<IsMap, std::pair<std::string_view, mapped_type>, std::string_view>;
+
+private:
+    const char* base;
+    std::size_t length;
+
+    const HeaderType& header() const
+    {
+        return *reinterpret_cast<const HeaderType*>(base);
+    }
+    const SlotType* twig(const SlotType* branch, TwigIndexType idx) const
+    {
+        return reinterpret_cast<const SlotType*>(base + branch->offset + BitmapType::size()) + idx;
+    }
+    //the twig of key, nullptr when key has none here
+    const SlotType* twig_of(const SlotType* branch, std::string_view key) const
+    {
+        NybbleType n = FanoutType::nybble_at(key, branch->nybble_index());
+        auto bitmap = BitmapType::load(base + branch->offset);
+        if (n != NybbleHead && FanoutType::test(bitmap, n)) {
+            return twig(branch, FanoutType::rank(bitmap, n) + branch->has_head());
+        }
+        if (n == NybbleHead && branch->has_head()) {
+            return twig(branch, 0);
+        }
+        return nullptr;
+    }
+    std::string_view key_of(const SlotType* leaf) const
+    {
+        return std::string_view(base + leaf->offset + (IsMap ? sizeof(mapped_type) : 0), leaf->key_size());
+    }
+    const SlotType* first_leaf(const SlotType* node) const
+    {
+        while (node->is_branch()) {
+            node = twig(node, 0);
+        }
+        return node;
+    }
+    const SlotType* find_leaf(std::string_view key) const
+    {
+        if (empty()) {
+            return nullptr;
+        }
+        const SlotType* node = &(header().root);
+        while (node != nullptr && node->is_branch()) {
+            node = twig_of(node, key);
+        }
+        if (node == nullptr || key_of(node) != key) {
+            return nullptr;
+        }
+        return node;
+    }
+    //every slot must point inside the mapping, children before their parents as the writer puts
+    //them, so a damaged image cannot send a walk outside the file or around in circles
+    bool valid() const
+    {
+        const HeaderType& h = header();
+        if (h.count == 0) {
+            return true;
+        }
+        uint64_t leaves = 0;
+        std::vector<const SlotType*> work{&(h.root)};
+        while (!work.empty()) {
+            const SlotType* node = work.back();
+            work.pop_back();
+            uint64_t offset = node->offset;
+            if (offset < sizeof(HeaderType) || offset % 8 != 0 || offset > length) {
+                return false;
+            }
+            if (!node->is_branch()) {
+                if (node->key_size() > length || length - offset < h.mapped_size + node->key_size()) {
+                    return false;
+                }
+                leaves++;
+                continue;
+            }
+            TwigIndexType size = node->twig_count();
+            if (length - offset < BitmapType::size() + size * sizeof(SlotType)
+                || size < 2 || size != FanoutType::count(BitmapType::load(base + offset)) + node->has_head()) {
+                return false;
+            }
+            for (TwigIndexType i = 0; i < size; i++) {
+                const SlotType* child = twig(node, i);
+                if (child->offset >= offset) {
+                    return false;
+                }
+                work.push_back(child);
+            }
+        }
+        return leaves == h.count;
+    }
+    void unmap()
+    {
+        if (base != nullptr) {
+            ::munmap(const_cast<char*>(base), length);
+            base = nullptr;
+        }
+    }
+
+public:
+    class Iterator
+    {
+        friend class MappedTrie;
+
+        const MappedTrie* trie;
+        std::vector<const SlotType*> stk; //top is the current leaf
+
+        void next_leaf()
+        {
+            if (!stk.empty() && !stk.back()->is_branch()) {
+                stk.pop_back();
+            }
+            while (!stk.empty() && stk.back()->is_branch()) {
+                const SlotType* branch = stk.back();
+                stk.pop_back();
+                for (TwigIndexType i = branch->twig_count(); i > 0; i--) {
+                    stk.push_back(trie->twig(branch, i - 1));
+                }
+            }
+        }
+        Iterator(const MappedTrie* t, const SlotType* node) : trie(t), stk{node}
+        {
+            if (node->is_branch()) {
+                next_leaf();
+            }
+        }
+        Iterator(const MappedTrie* t, const SlotType* branch, TwigIndexType first, TwigIndexType last) : trie(t)
+        {
+            for (TwigIndexType i = last; i > first; i--) {
+                stk.push_back(trie->twig(branch, i - 1));
+            }
+            if (!stk.empty() && stk.back()->is_branch()) {
+                next_leaf();
+            }
+        }
+
+    public:
+        Iterator() : trie(nullptr) {}
+
+        std::string_view key() const
+        {
+            return trie->key_of(stk.back());
+        }
+        template <bool M = IsMap, std::enable_if_t<M, bool> = true>
+        const mapped_type& value() const
+        {
+            return *reinterpret_cast<const mapped_type*>(trie->base + stk.back()->offset);
+        }
+        value_type operator*() const
+        {
+            if constexpr (IsMap) {
+                return value_type(key(), value());
+            } else {
+                return key();
+            }
+        }
+        Iterator& operator++()
+        {
+            next_leaf();
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator tmp(*this);
+            next_leaf();
+            return tmp;
+        }
+        bool operator==(const Iterator& rhs) const
+        {
+            if (stk.empty() && rhs.stk.empty()) return true;
+            if (!stk.empty() && !rhs.stk.empty()) return stk.back() == rhs.stk.back();
+            return false;
+        }
+        bool operator!=(const Iterator& rhs) const
+        {
+            return !(operator==(rhs));
+        }
+    };
+
+    explicit MappedTrie(const std::string& path) : base(nullptr), length(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "MappedTrie: cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(HeaderType)) {
+            ::close(fd);
+            throw std::runtime_error("MappedTrie: not a trie image " + path);
+        }
+        length = st.st_size;
+        void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            throw std::system_error(err, std::generic_category(), "MappedTrie: cannot map " + path);
+        }
+        base = static_cast<const char*>(p);
+        const HeaderType& h = header();
+        if (std::memcmp(h.magic, jzt::detail::qp::MappedMagic, sizeof(h.magic)) != 0 || h.version != jzt::detail::qp::MappedVersion
+            || h.bits != Bits || h.mapped_size != (IsMap ? sizeof(mapped_type) : 0) || h.size != length) {
+            unmap();
+            throw std::runtime_error("MappedTrie: incompatible trie image " + path);
+        }
+        if (!valid()) {
+            unmap();
+            throw std::runtime_error("MappedTrie: corrupt trie image " + path);
+        }
+    }
+    MappedTrie(MappedTrie&& o) : base(o.base), length(o.length)
+    {
+        o.base = nullptr;
+    }
+    MappedTrie(const MappedTrie&) = delete;
+    MappedTrie& operator= (const MappedTrie&) = delete;
+    MappedTrie& operator= (MappedTrie&& o)
+    {
+        if (this != &o) {
+            unmap();
+            base = o.base;
+            length = o.length;
+            o.base = nullptr;
+        }
+        return *this;
+    }
+    ~MappedTrie()
+    {
+        unmap();
+    }
+
+    bool empty() const
+    {
+        return header().count == 0;
+    }
+    std::size_t size() const
+    {
+        return header().count;
+    }
+    Iterator begin() const
+    {
+        if (empty()) {
+            return {};
+        }
+        return Iterator(this, &(header().root));
+    }
+    Iterator end() const
+    {
+        return {};
+    }
+    //the iterator goes on to the keys after key
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    Iterator find(const T& k) const
+    {
+        if (empty()) {
+            return {};
+        }
+        std::string_view key(k);
+        Iterator it;
+        it.trie = this;
+        const SlotType* node = &(header().root);
+        while (node->is_branch()) {
+            const SlotType* next = twig_of(node, key);
+            if (next == nullptr) {
+                return {};
+            }
+            //the twigs right of the path are what comes after the leaf
+            for (TwigIndexType i = node->twig_count(); twig(node, i - 1) != next; i--) {
+                it.stk.push_back(twig(node, i - 1));
+            }
+            node = next;
+        }
+        if (key_of(node) != key) {
+            return {};
+        }
+        it.stk.push_back(node);
+        return it;
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains(const T& key) const
+    {
+        return find_leaf(std::string_view(key)) != nullptr;
+    }
+    //same walk as Node::get_prefix
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    Iterator prefix(const T& p) const
+    {
+        if (empty()) {
+            return {};
+        }
+        std::string_view prefix(p);
+        NybbleIndexType whole = FanoutType::nybbles_in(prefix.size());
+        const SlotType* node = &(header().root);
+        TwigIndexType first = 0, last = 0;
+        while (node->is_branch()) {
+            NybbleIndexType ni = node->nybble_index();
+            NybbleType n = FanoutType::nybble_at(prefix, ni);
+            auto bitmap = BitmapType::load(base + node->offset);
+            if (ni < whole) {
+                if (!FanoutType::test(bitmap, n)) {
+                    return {};
+                }
+                node = twig(node, FanoutType::rank(bitmap, n) + node->has_head());
+                continue;
+            }
+            if (ni * Bits >= prefix.size() * 8) {
+                first = 0;
+                last = node->twig_count();
+                break;
+            }
+            unsigned pad = (ni + 1) * Bits - prefix.size() * 8;
+            NybbleType n_max = n | ((1 << pad) - 1);
+            first = FanoutType::rank(bitmap, n) + node->has_head();
+            last = FanoutType::rank(bitmap, n_max) + FanoutType::test(bitmap, n_max) + node->has_head();
+            if (first == last) {
+                return {};
+            }
+            if (last - first > 1) {
+                break;
+            }
+            node = twig(node, first);
+            first = last = 0;
+        }
+        const SlotType* leaf = node->is_branch() ? first_leaf(twig(node, first)) : node;
+        if (key_of(leaf).compare(0, prefix.size(), prefix) != 0) {
+            return {};
+        }
+        if (!node->is_branch()) {
+            return Iterator(this, node);
+        }
+        return Iterator(this, node, first, last);
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains_prefix(const T& p) const
+    {
+        return prefix(p) != end();
+    }
+};
+
+} //namespace jzt::qp
+} //namespace jzt
+
+#endif // MAPPED_TRIE_HPP
@@ -0,0 +1,405 @@
+#ifndef PATTERN_HPP
+#define PATTERN_HPP
+
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//glob and regex patterns compiled to a byte DFA, for Trie::match. a pattern always matches whole
+//keys
+//  glob:  * any bytes, ? one byte, [abc] [a-z] [!a-z] [^a-z] classes, \ escapes the next byte
+//  regex: literals, ., classes as in glob with ^ for negation, ( ), |, *, +, ?, \ escapes, a
+//         leading ^ and a trailing $ are accepted and ignored
+
+namespace jzt {
+
+namespace detail {
+
+namespace qp {
+
+//thompson construction, every state has a byte edge or epsilon edges
+class PatternNfa
+{
+public:
+    struct State
+    {
+        std::bitset<256> bytes;
+        int next = -1; //target of the byte edge
+        std::vector<int> epsilon;
+    };
+    struct Fragment
+    {
+        int start;
+        int end;
+    };
+
+    std::vector<State> states;
+
+    int add()
+    {
+        states.emplace_back();
+        return states.size() - 1;
+    }
+    Fragment bytes(const std::bitset<256>& set)
+    {
+        int s = add();
+        int e = add();
+        states[s].bytes = set;
+        states[s].next = e;
+        return {s, e};
+    }
+    Fragment byte(unsigned char b)
+    {
+        std::bitset<256> set;
+        set.set(b);
+        return bytes(set);
+    }
+    Fragment any()
+    {
+        return bytes(std::bitset<256>().set());
+    }
+    Fragment empty()
+    {
+        int s = add();
+        int e = add();
+        states[s].epsilon.push_back(e);
+        return {s, e};
+    }
+    Fragment concat(Fragment a, Fragment b)
+    {
+        states[a.end].epsilon.push_back(b.start);
+        return {a.start, b.end};
+    }
+    Fragment alternate(Fragment a, Fragment b)
+    {
+        int s = add();
+        int e = add();
+        states[s].epsilon = {a.start, b.start};
+        states[a.end].epsilon.push_back(e);
+        states[b.end].epsilon.push_back(e);
+        return {s, e};
+    }
+    //min 0 or 1, max 1 or unbounded
+    Fragment repeat(Fragment a, bool optional, bool many)
+    {
+        int s = add();
+        int e = add();
+        states[s].epsilon.push_back(a.start);
+        if (optional) {
+            states[s].epsilon.push_back(e);
+        }
+        if (many) {
+            states[a.end].epsilon.push_back(a.start);
+        }
+        states[a.end].epsilon.push_back(e);
+        return {s, e};
+    }
+};
+
+//parses a glob or a regex into a PatternNfa
+class PatternParser
+{
+    using Fragment = PatternNfa::Fragment;
+
+    PatternNfa& nfa;
+    std::string_view text;
+    std::size_t pos;
+
+    [[noreturn]] void fail(const char* what) const
+    {
+        throw std::invalid_argument(std::string("Pattern: ") + what + " at " + std::to_string(pos) + " in " + std::string(text));
+    }
+    bool done() const
+    {
+        return pos >= text.size();
+    }
+    unsigned char take()
+    {
+        if (done()) {
+            fail("unexpected end");
+        }
+        return text[pos++];
+    }
+    //after the [, up to and including the ]
+    std::bitset<256> parse_class(bool glob)
+    {
+        std::bitset<256> set;
+        bool negate = false;
+        if (!done() && (text[pos] == '^' || (glob && text[pos] == '!'))) {
+            negate = true;
+            pos++;
+        }
+        bool first = true;
+        for (;;) {
+            unsigned char c = take();
+            if (c == ']' && !first) {
+                break;
+            }
+            first = false;
+            if (c == '\\') {
+                c = take();
+            }
+            unsigned char hi = c;
+            if (pos + 1 < text.size() && text[pos] == '-' && text[pos + 1] != ']') {
+                pos++;
+                hi = take();
+                if (hi == '\\') {
+                    hi = take();
+                }
+                if (hi < c) {
+                    fail("reversed class range");
+                }
+            }
+            for (unsigned b = c; b <= hi; b++) {
+                set.set(b);
+            }
+        }
+        return negate ? ~set : set;
+    }
+
+    Fragment parse_alternation()
+    {
+        Fragment f = parse_concatenation();
+        while (!done() && text[pos] == '|') {
+            pos++;
+            f = nfa.alternate(f, parse_concatenation());
+        }
+        return f;
+    }
+    Fragment parse_concatenation()
+    {
+        Fragment f = nfa.empty();
+        while (!done() && text[pos] != '|' && text[pos] != ')') {
+            if (text[pos] == '$' && pos + 1 == text.size()) {
+                pos++;
+                break;
+            }
+            f = nfa.concat(f, parse_repeat());
+        }
+        return f;
+    }
+    Fragment parse_repeat()
+    {
+        Fragment f = parse_atom();
+        while (!done() && (text[pos] == '*' || text[pos] == '+' || text[pos] == '?')) {
+            char op = text[pos++];
+            f = nfa.repeat(f, op != '+', op != '?');
+        }
+        return f;
+    }
+    Fragment parse_atom()
+    {
+        unsigned char c = take();
+        switch (c) {
+        case '(': {
+            Fragment f = parse_alternation();
+            if (take() != ')') {
+                fail("missing )");
+            }
+            return f;
+        }
+        case '.':
+            return nfa.any();
+        case '[':
+            return nfa.bytes(parse_class(false));
+        case '\\':
+            return nfa.byte(take());
+        case '*':
+        case '+':
+        case '?':
+            pos--;
+            fail("nothing to repeat");
+        default:
+            return nfa.byte(c);
+        }
+    }
+
+public:
+    PatternParser(PatternNfa& n, std::string_view t) : nfa(n), text(t), pos(0) {}
+
+    Fragment parse_glob()
+    {
+        Fragment f = nfa.empty();
+        while (!done()) {
+            unsigned char c = take();
+            if (c == '*') {
+                f = nfa.concat(f, nfa.repeat(nfa.any(), true, true));
+            } else if (c == '?') {
+                f = nfa.concat(f, nfa.any());
+            } else if (c == '[') {
+                f = nfa.concat(f, nfa.bytes(parse_class(true)));
+            } else {
+                f = nfa.concat(f, nfa.byte(c == '\\' ? take() : c));
+            }
+        }
+        return f;
+    }
+    Fragment parse_regex()
+    {
+        if (!done() && text[pos] == '^') {
+            pos++;
+        }
+        Fragment f = parse_alternation();
+        if (!done()) {
+            fail("unbalanced )");
+        }
+        return f;
+    }
+};
+
+} //namespace jzt::detail::qp
+
+} //namespace jzt::detail
+
+namespace qp {
+
+//a byte DFA, the automaton Trie::match walks the trie with. state 0 is the dead state
+class Pattern
+{
+public:
+    using state_type = uint32_t;
+    static constexpr std::size_t MaxStates = 1 << 14;
+
+private:
+    std::vector<state_type> table; //256 transitions per state
+    std::vector<char> accepting;
+    std::vector<char> live; //an accepting state can still be reached
+
+    Pattern() = default;
+
+    //subset construction over the nfa, the states are numbered in the order they are found
+    static Pattern compile(jzt::detail::qp::PatternNfa& nfa, jzt::detail::qp::PatternNfa::Fragment f)
+    {
+        using Set = std::vector<int>;
+        auto closure = [&](Set set) {
+            std::vector<char> seen(nfa.states.size());
+            for (int s : set) {
+                seen[s] = 1;
+            }
+            for (std::size_t i = 0; i < set.size(); i++) {
+                for (int t : nfa.states[set[i]].epsilon) {
+                    if (!seen[t]) {
+                        seen[t] = 1;
+                        set.push_back(t);
+                    }
+                }
+            }
+            Set sorted;
+            for (std::size_t s = 0; s < seen.size(); s++) {
+                if (seen[s] && (nfa.states[s].next >= 0 || (int)s == f.end)) {
+                    sorted.push_back(s);
+                }
+            }
+            return sorted;
+        };
+        Pattern p;
+        std::map<Set, state_type> ids;
+        std::vector<Set> sets;
+        auto id = [&](Set&& set) {
+            auto [it, inserted] = ids.emplace(set, sets.size());
+            if (inserted) {
+                if (sets.size() >= MaxStates) {
+                    throw std::invalid_argument("Pattern: too many DFA states");
+                }
+                sets.push_back(std::move(set));
+            }
+            return it->second;
+        };
+        id(Set());
+        id(closure({f.start}));
+        for (state_type d = 0; d < sets.size(); d++) {
+            p.table.resize((d + 1) * 256);
+            for (unsigned b = 0; b < 256; b++) {
+                Set moved;
+                for (int s : sets[d]) {
+                    if (nfa.states[s].next >= 0 && nfa.states[s].bytes[b]) {
+                        moved.push_back(nfa.states[s].next);
+                    }
+                }
+                state_type to = moved.empty() ? 0 : id(closure(std::move(moved)));
+                p.table[d * 256 + b] = to;
+            }
+        }
+        std::size_t n = sets.size();
+        p.accepting.resize(n);
+        p.live.resize(n);
+        std::vector<std::vector<state_type>> reverse(n);
+        std::vector<state_type> work;
+        for (state_type d = 0; d < n; d++) {
+            for (int s : sets[d]) {
+                if (s == f.end) {
+                    p.accepting[d] = p.live[d] = 1;
+                    work.push_back(d);
+                }
+            }
+            for (unsigned b = 0; b < 256; b++) {
+                reverse[p.table[d * 256 + b]].push_back(d);
+            }
+        }
+        while (!work.empty()) {
+            state_type d = work.back();
+            work.pop_back();
+            for (state_type from : reverse[d]) {
+                if (!p.live[from]) {
+                    p.live[from] = 1;
+                    work.push_back(from);
+                }
+            }
+        }
+        return p;
+    }
+
+public:
+    static Pattern glob(std::string_view text)
+    {
+        jzt::detail::qp::PatternNfa nfa;
+        auto f = jzt::detail::qp::PatternParser(nfa, text).parse_glob();
+        return compile(nfa, f);
+    }
+    static Pattern regex(std::string_view text)
+    {
+        jzt::detail::qp::PatternNfa nfa;
+        auto f = jzt::detail::qp::PatternParser(nfa, text).parse_regex();
+        return compile(nfa, f);
+    }
+
+    state_type start() const
+    {
+        return 1;
+    }
+    state_type next(state_type state, unsigned char byte) const
+    {
+        return table[state * 256 + byte];
+    }
+    bool accepts(state_type state) const
+    {
+        return accepting[state];
+    }
+    //no key continuing from state can match
+    bool dead(state_type state) const
+    {
+        return !live[state];
+    }
+    std::size_t state_count() const
+    {
+        return accepting.size();
+    }
+    bool matches(std::string_view key) const
+    {
+        state_type s = start();
+        for (std::size_t i = 0; i < key.size() && !dead(s); i++) {
+            s = next(s, key[i]);
+        }
+        return accepts(s);
+    }
+};
+
+} //namespace jzt::qp
+} //namespace jzt
+
+#endif // PATTERN_HPP
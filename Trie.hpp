@@ -3,19 +3,205 @@
 
 #include <utility>
 #include <vector>
-#include <variant>
 #include <string_view>
 #include <optional>
 #include <functional>
 #include <type_traits>
-#include <stack>
+#include <iterator>
 #include <new>
 #include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <memory_resource>
+#include <memory>
+#include <unordered_map>
+#include <limits>
+#include <array>
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace jzt {
+namespace qp {
+
+//specialize for a DataType that can be moved with memcpy, twig arrays are then shifted with memmove
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+//summary policies, the last parameter of Trie. with a policy other than NoSummary every branch
+//keeps the number of leaves below it and their summary, a monoid over the elements:
+//  type                                              the summary
+//  static type identity()                            the summary of no element
+//  static type of(const DataType& element)           the summary of one element
+//  static type combine(const type& a, const type& b) associative, a covers the smaller keys
+//when type is not empty the summaries depend on the elements, which are then read only through
+//iterators and for_each_prefix_of and are changed with Trie::update
+struct NoSummary
+{
+    struct type {};
+};
+//only the leaf counts, for count_prefix, rank and select
+struct LeafCount
+{
+    struct type {};
+    static type identity()
+    {
+        return {};
+    }
+    template <typename T>
+    static type of(const T&)
+    {
+        return {};
+    }
+    static type combine(const type&, const type&)
+    {
+        return {};
+    }
+};
+//the largest score below each branch, for top_k. Score is a function object returning the score
+//of an element
+template <typename Score, typename ScoreType = double>
+struct MaxScore
+{
+    using type = ScoreType;
+    static type identity()
+    {
+        return std::numeric_limits<type>::lowest();
+    }
+    template <typename T>
+    static type of(const T& element)
+    {
+        return Score{}(element);
+    }
+    static type combine(const type& a, const type& b)
+    {
+        return std::max(a, b);
+    }
+};
+//the policies whose summary is the largest score below a branch, which top_k relies on. specialize
+//for another policy that combines with max
+template <typename Summary>
+struct is_max_score : std::false_type {};
+template <typename Score, typename ScoreType>
+struct is_max_score<MaxScore<Score, ScoreType>> : std::true_type {};
+
+//what the instrumentation policies count
+enum class Counter : unsigned
+{
+    SimilarWalks, //find_similar calls
+    SimilarNodes, //nodes they visited
+    MismatchBytes, //key bytes find_mismatch compared up to the first difference, that one included
+    LeafBursts, //leaves turned into branches
+    TwigExpansions, //twig arrays regrown by twig_expand_emplace_at
+    TwigAllocations,
+    TwigFrees,
+    RemoveCollapses, //branches replaced by their last twig in remove
+    Count
+};
+inline const char* counter_name(Counter c)
+{
+    static const char* const names[] = {
+        "similar_walks", "similar_nodes", "mismatch_bytes", "leaf_bursts",
+        "twig_expansions", "twig_allocations", "twig_frees", "remove_collapses",
+    };
+    return names[(unsigned)c];
+}
+
+//instrumentation policies, the last parameter of Trie. the default counts nothing and compiles away
+struct NoCounters
+{
+    static void add(Counter, uint64_t) {}
+};
+//counts into a block per thread, the writes are plain relaxed stores to memory only that thread
+//writes. totals() adds up the blocks of the running threads and what exited threads left behind.
+//Tag separates the counters of different tries
+template <typename Tag = void>
+class ThreadCounters
+{
+public:
+    using Values = std::array<uint64_t, (std::size_t)Counter::Count>;
+
+private:
+    struct Block;
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<Block*> blocks;
+        Values retired{};
+    };
+    struct Block
+    {
+        std::atomic<uint64_t> values[(std::size_t)Counter::Count] = {};
+
+        Block()
+        {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.blocks.push_back(this);
+        }
+        ~Block()
+        {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            for (std::size_t i = 0; i < r.retired.size(); i++) {
+                r.retired[i] += values[i].load(std::memory_order_relaxed);
+            }
+            r.blocks.erase(std::find(r.blocks.begin(), r.blocks.end(), this));
+        }
+    };
+    static Registry& registry()
+    {
+        static Registry r;
+        return r;
+    }
+    static Block& local()
+    {
+        thread_local Block block;
+        return block;
+    }
+
+public:
+    static void add(Counter c, uint64_t n)
+    {
+        auto& value = local().values[(std::size_t)c];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static Values totals()
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        Values sum = r.retired;
+        for (Block* block : r.blocks) {
+            for (std::size_t i = 0; i < sum.size(); i++) {
+                sum[i] += block->values[i].load(std::memory_order_relaxed);
+            }
+        }
+        return sum;
+    }
+    //f(name, value) for every counter, for exporting
+    template <typename F>
+    static void for_each(F&& f)
+    {
+        Values sum = totals();
+        for (std::size_t i = 0; i < sum.size(); i++) {
+            f(counter_name((Counter)i), sum[i]);
+        }
+    }
+};
+
+} //namespace jzt::qp
+
 namespace detail {
 
 namespace trait {
@@ -27,6 +213,12 @@ struct is_pair : std::false_type {};
 template <class T1, class T2>
 struct is_pair<std::pair<T1, T2>> : std::true_type {};
 
+template <class T, class = void>
+struct has_capacity : std::false_type {};
+
+template <class T>
+struct has_capacity<T, std::void_t<decltype(std::declval<const T&>().data()), decltype(std::declval<const T&>().capacity())>> : std::true_type {};
+
 }
 
 namespace qp {
@@ -94,10 +286,230 @@ struct DataTraints
     }
 };
 
-using TwigIndexType = uint8_t;
-using NybbleType = uint8_t;
+using TwigIndexType = uint16_t;
+using NybbleType = uint16_t;
 using NybbleIndexType = uint64_t;
-static constexpr uint8_t NybbleHead = 0xFF;
+static constexpr NybbleType NybbleHead = 0xFFFF;
+
+//first differing byte of a and b in [0, n), n when they are equal
+//16 or 32 bytes are compared per step, the position comes from ctz of the inequality mask
+namespace simd {
+
+inline std::size_t mismatch_scalar(const unsigned char* a, const unsigned char* b, std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        if (x != y) {
+            return i + (__builtin_ctzll(x ^ y) >> 3);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+inline std::size_t mismatch_sse2(const unsigned char* a, const unsigned char* b, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline std::size_t mismatch_avx2(const unsigned char* a, const unsigned char* b, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + mismatch_sse2(a + i, b + i, n - i);
+}
+#endif
+
+using MismatchFunction = std::size_t (*)(const unsigned char*, const unsigned char*, std::size_t);
+
+//picked once from the running cpu
+inline MismatchFunction mismatch_function()
+{
+    static const MismatchFunction f = []() -> MismatchFunction {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return mismatch_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return mismatch_sse2;
+        }
+#endif
+        return mismatch_scalar;
+    }();
+    return f;
+}
+
+inline std::size_t mismatch(const char* a, const char* b, std::size_t n)
+{
+    auto x = reinterpret_cast<const unsigned char*>(a);
+    auto y = reinterpret_cast<const unsigned char*>(b);
+    if (n < 16) {
+        return mismatch_scalar(x, y, n);
+    }
+    return mismatch_function()(x, y, n);
+}
+
+} //namespace jzt::detail::qp::simd
+
+//twig bitmap of the 8-bit fan-out
+struct WideBitmap
+{
+    uint64_t words[4];
+};
+
+//keys are cut into Bits wide nybbles, most significant bits first, so twig order is the
+//lexicographic order of the keys. a nybble running past the end of the key is padded with
+//zero bits, one starting past the end is NybbleHead
+template <unsigned Bits>
+struct Fanout
+{
+    static_assert(Bits == 4 || Bits == 5 || Bits == 6 || Bits == 8, "fan-out width must be 4, 5, 6 or 8 bits");
+
+    static constexpr unsigned bits = Bits;
+    static constexpr TwigIndexType twig_max = (1 << Bits) + 1; //+ head
+
+    using Bitmap = std::conditional_t<Bits == 4, uint16_t,
+                   std::conditional_t<Bits == 5, uint32_t,
+                   std::conditional_t<Bits == 6, uint64_t, WideBitmap>>>;
+
+    static bool test(const Bitmap& bitmap, NybbleType n)
+    {
+        if constexpr (Bits == 8) {
+            return (bitmap.words[n >> 6] >> (n & 63)) & 1;
+        } else {
+            return (bitmap >> n) & 1;
+        }
+    }
+    static Bitmap with(Bitmap bitmap, NybbleType n)
+    {
+        if constexpr (Bits == 8) {
+            bitmap.words[n >> 6] |= (uint64_t)1 << (n & 63);
+            return bitmap;
+        } else {
+            return bitmap | ((Bitmap)1 << n);
+        }
+    }
+    static Bitmap without(Bitmap bitmap, NybbleType n)
+    {
+        if constexpr (Bits == 8) {
+            bitmap.words[n >> 6] &= ~((uint64_t)1 << (n & 63));
+            return bitmap;
+        } else {
+            return bitmap & ~((Bitmap)1 << n);
+        }
+    }
+    //set bits below n
+    static unsigned rank(const Bitmap& bitmap, NybbleType n)
+    {
+        if constexpr (Bits == 8) {
+            unsigned r = 0;
+            for (unsigned w = 0; w < (unsigned)(n >> 6); w++) {
+                r += __builtin_popcountll(bitmap.words[w]);
+            }
+            if (n & 63) {
+                r += __builtin_popcountll(bitmap.words[n >> 6] & (((uint64_t)1 << (n & 63)) - 1));
+            }
+            return r;
+        } else {
+            return __builtin_popcountll((uint64_t)bitmap & (((uint64_t)1 << n) - 1));
+        }
+    }
+    static unsigned count(const Bitmap& bitmap)
+    {
+        if constexpr (Bits == 8) {
+            return __builtin_popcountll(bitmap.words[0]) + __builtin_popcountll(bitmap.words[1])
+                 + __builtin_popcountll(bitmap.words[2]) + __builtin_popcountll(bitmap.words[3]);
+        } else {
+            return __builtin_popcountll((uint64_t)bitmap);
+        }
+    }
+
+    static NybbleType nybble_at(std::string_view key, NybbleIndexType ni)
+    {
+        if constexpr (Bits == 8) {
+            if (ni >= key.size()) return NybbleHead;
+            return (uint8_t)key[ni];
+        } else if constexpr (Bits == 4) {
+            uint64_t bi = ni / 2;
+            if (bi >= key.size()) return NybbleHead;
+            uint8_t b = key[bi];
+            if ((ni & 1) == 0) {
+                return b >> 4;
+            } else {
+                return b & 0x0F;
+            }
+        } else {
+            uint64_t bit = ni * Bits;
+            uint64_t bi = bit / 8;
+            if (bi >= key.size()) return NybbleHead;
+            unsigned word = (unsigned)(uint8_t)key[bi] << 8;
+            if (bi + 1 < key.size()) {
+                word |= (uint8_t)key[bi + 1];
+            }
+            return (word >> (16 - bit % 8 - Bits)) & ((1 << Bits) - 1);
+        }
+    }
+    //nybbles lying completely inside the first bytes of a key
+    static NybbleIndexType nybbles_in(std::size_t bytes)
+    {
+        return bytes * 8 / Bits;
+    }
+    //compare two keys and find the first differing nybble in one pass, empty when they are equal
+    static std::optional<NybbleIndexType> find_mismatch(std::string_view a, std::string_view b)
+    {
+        std::size_t compared;
+        return find_mismatch(a, b, compared);
+    }
+    //compared is set to the bytes the answer depends on, the common prefix and the first differing byte
+    static std::optional<NybbleIndexType> find_mismatch(std::string_view a, std::string_view b, std::size_t& compared)
+    {
+        std::size_t n = std::min(a.size(), b.size());
+        std::size_t i = simd::mismatch(a.data(), b.data(), n);
+        compared = i < n ? i + 1 : n;
+        if (i < n) {
+            uint8_t diff = (uint8_t)a[i] ^ (uint8_t)b[i];
+            return {(i * 8 + __builtin_clz(diff) - 24) / Bits};
+        }
+        if (a.size() == b.size()) {
+            return {};
+        }
+        //one key is a prefix of the other, the nybble it ends in may still match
+        NybbleIndexType ni = nybbles_in(n);
+        if ((n * 8) % Bits != 0 && nybble_at(a, ni) == nybble_at(b, ni)) {
+            ni++;
+        }
+        return {ni};
+    }
+};
 
 template <class DataType, bool IsMap>
 struct Leaf
@@ -120,21 +532,31 @@ struct Leaf
     static_assert (!IsMap || std::is_nothrow_move_assignable_v<mapped_type>, "mapped_type must be nothrow move assignable");
 
     template <typename ...ValueArgs, std::enable_if_t<IsMap && std::is_constructible_v<value_type, ValueArgs...>, bool> = true>
-    Leaf(ValueArgs&& ...args) : data(std::forward<ValueArgs>(args)...) {}
+    Leaf(ValueArgs&& ...args) : tag(0), data(std::forward<ValueArgs>(args)...)
+    {
+        length = std::string_view(get_key()).size();
+    }
 
     //unused
     template <typename KeyArg, typename ...MappedArgs,
               std::enable_if_t<IsMap && std::is_constructible_v<key_type, KeyArg> && std::is_constructible_v<mapped_type, MappedArgs...>, bool> = true>
-    Leaf(KeyArg&& key, MappedArgs&& ...args) : data(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(args)...) {}
+    Leaf(KeyArg&& key, MappedArgs&& ...args) : tag(0), data(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(args)...)
+    {
+        length = std::string_view(get_key()).size();
+    }
 
 
     template <typename ...KeyArgs, std::enable_if_t<!IsMap && std::is_constructible_v<key_type, KeyArgs...>, bool> = true>
-    Leaf(KeyArgs&& ...args) : data(std::forward<KeyArgs>(args)...) {}
+    Leaf(KeyArgs&& ...args) : tag(0), data(std::forward<KeyArgs>(args)...)
+    {
+        length = std::string_view(get_key()).size();
+    }
 
-    Leaf(Leaf&& leaf) : data(std::move(leaf.data)) {}
-    Leaf(const Leaf& leaf) = delete;
+    Leaf(Leaf&& leaf) : tag(0), length(leaf.length), data(std::move(leaf.data)) {}
+    Leaf(const Leaf& leaf) : tag(0), length(leaf.length), data(leaf.data) {}
     Leaf& operator= (Leaf&& leaf)
     {
+        length = leaf.length;
         data = std::move(leaf.data);
         return *this;
     }
@@ -143,6 +565,20 @@ struct Leaf
     {
         return DataTraintsType::get_key(data);
     }
+    //uses the cached length, so C string keys are never rescanned
+    std::string_view key_view() const
+    {
+        const key_type& key = get_key();
+        if constexpr (std::is_pointer_v<key_type>) {
+            return std::string_view(key, length);
+        } else {
+            return std::string_view(std::string_view(key).data(), length);
+        }
+    }
+    NybbleIndexType key_size() const
+    {
+        return length;
+    }
     value_type& get_value()
     {
         return DataTraintsType::get_value(data);
@@ -151,267 +587,707 @@ struct Leaf
     {
         return data;
     }
-    std::optional<NybbleIndexType> find_mismatch(std::string_view sv) const
+    bool key_equal(std::string_view sv) const
     {
-        std::string_view key(get_key());
-        for (NybbleIndexType i = 0; i < sv.size() && i < key.size(); i++) {
-            NybbleType diff = (uint8_t)sv[i] ^ (uint8_t)key[i];
-            if (diff != 0) {
-                if ((diff & 0x0F) == 0) {
-                    return {1 + i * 2};
-                } else {
-                    return {i * 2};
-                }
-            }
-        }
-        if (sv.size() == key.size()) {
-            return {};
-        }
-        return {std::min(sv.size(), key.size()) * 2};
+        return length == sv.size() && simd::mismatch(key_view().data(), sv.data(), length) == length;
     }
 private:
+    uint64_t
+        tag : 1, //always 0, shares its bit with Branch::tag
+        length : 63; //cached key length, fills the rest of the tag word
     DataType data;
 };
 
-static NybbleType nybble_at(std::string_view key, NybbleIndexType ni)
+template <typename NodeType>
+struct TwigArray
 {
-    uint64_t bi = ni / 2;
-    if (bi >= key.size()) return NybbleHead;
-    uint8_t b = key[bi];
-    if ((ni & 1) == 0) {
-        return b & 0x0F;
-    } else {
-        return b >> 4;
-    }
-}
-
-template <typename DataType, bool IsMap>
-class Node;
-
-template <typename DataType, bool IsMap>
-class Branch {
-    using NodeType = Node<DataType, IsMap>;
-    using LeafType = Leaf<DataType, IsMap>;
     NodeType* twigs;
-    uint64_t
-        head : 1, //head flag
-        capacity : 5, //twig capacity [0, 17]
-        size : 5, //twig size [0, 16] + head => [0, 17]
-        index : 37, //nybble index
-        bitmap : 16; //twigs bitmap
+    TwigIndexType size;
+    TwigIndexType capacity;
+};
 
-private:
+//owner counts of the twig arrays a trie shares with its snapshots, an array missing from counts
+//has a single owner. snapshots may be dropped on any thread, the arrays they free are handed back
+//to the pool of the trie on its next write
+template <typename NodeType>
+struct SharedTwigs
+{
+    using ArrayType = TwigArray<NodeType>;
 
-    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
-    void twig_init_one(Args&& ...args)
+    std::mutex mutex;
+    std::unordered_map<NodeType*, uint32_t> counts; //owners besides the first one
+    std::atomic<std::size_t> entries{0}; //counts.size(), only grows on the thread of the trie
+    std::vector<ArrayType> garbage;
+    std::atomic<bool> has_garbage{false};
+    std::atomic<std::size_t> snapshots{0};
+    bool trie_shares = false; //the trie may hold shared arrays, only used on the thread of the trie
+
+    //the rest is called with mutex held
+    bool is_shared(NodeType* twigs) const
     {
-        size = 1;
-        capacity = 2;
-        twigs = static_cast<NodeType*>(std::malloc(capacity * sizeof (NodeType)));
-        if (twigs == nullptr) {
-            throw std::bad_alloc();
-        }
-        new (&twigs[0]) NodeType(std::forward<Args>(args)...);
+        return counts.find(twigs) != counts.end();
     }
-    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
-    void twig_expand_emplace_at(TwigIndexType idx, Args&& ...args)
+    void share(NodeType* twigs)
     {
-        assert(capacity <= 17);
-        int new_capacity = std::min((int)(capacity * 1.5), 17);
-        NodeType* new_twigs = static_cast<NodeType*>(std::malloc(new_capacity * sizeof(NodeType)));
-        if (new_twigs == nullptr) {
-            throw std::bad_alloc();
-        }
-        int i = 0, j = 0;
-        for (; i < idx; i++) {
-            new (&new_twigs[j]) NodeType(std::move(twigs[i]));
-            j++;
-        }
-        j++;
-        for (; i < size; i++) {
-            new (&new_twigs[j]) NodeType(std::move(twigs[i]));
-            j++;
-        }
-        new (&new_twigs[idx]) NodeType(std::forward<Args>(args)...);
-        for (i = 0; i < size; i++) {
-            twigs[i].~NodeType();
+        if (counts[twigs]++ == 0) {
+            entries.fetch_add(1, std::memory_order_relaxed);
         }
-        std::free(twigs);
-        twigs = new_twigs;
-        size++;
-        capacity = new_capacity;
     }
-    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
-    void twig_emplace_at(TwigIndexType idx, Args&& ...args)
-    {
-        assert(size < 17);
-        assert(idx <= size);
-        if (size + 1 > capacity) {
-            twig_expand_emplace_at(idx, std::forward<Args>(args)...);
-        } else {
-            if (idx < size) {
-                int i = size;
-                new (&twigs[i]) NodeType(std::move(twigs[i - 1]));
-                i--;
-                for (; i > idx; i--) {
-                    twigs[i] = std::move(twigs[i - 1]);
+    //drop one owner of array, arrays left without owners have their twigs destroyed and are
+    //appended to freed
+    void release(ArrayType array, std::vector<ArrayType>& freed)
+    {
+        std::vector<ArrayType> work{array};
+        while (!work.empty()) {
+            ArrayType a = work.back();
+            work.pop_back();
+            auto it = counts.find(a.twigs);
+            if (it != counts.end()) {
+                if (--(it->second) == 0) {
+                    counts.erase(it);
+                    //pairs with the acquire in make_unique, reads by a snapshot that drops the last
+                    //share of an array happen before the trie writes to it without locking
+                    entries.fetch_sub(1, std::memory_order_release);
                 }
-                twigs[idx] = NodeType(std::forward<Args>(args)...);
-            } else {
-                new (&twigs[idx]) NodeType(std::forward<Args>(args)...);
+                continue;
             }
-            size++;
+            for (TwigIndexType i = 0; i < a.size; i++) {
+                NodeType& twig = a.twigs[i];
+                if (twig.is_branch()) {
+                    auto& branch = twig.get_branch();
+                    work.push_back({branch.twig(0), branch.twig_count(), branch.twig_capacity()});
+                }
+                twig.~NodeType();
+            }
+            freed.push_back(a);
         }
     }
-    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
-    void twig_emplace_back(Args&& ...args)
+};
+
+//twig arrays are carved from large chunks, one free list per capacity
+//freed arrays are recycled in O(1), chunks are released in bulk with the pool
+//chunks come from the upstream memory resource (an arena, huge pages, ...)
+template <typename NodeType>
+class TwigPool
+{
+    struct FreeTwigs
     {
-        assert(size < 17);
-        twig_emplace_at(size, std::forward<Args>(args)...);
-    }
+        FreeTwigs* next;
+    };
+    struct Chunk
+    {
+        Chunk* next;
+    };
 
-    void twig_erase_at(TwigIndexType idx)
+    static constexpr std::size_t chunk_header_size()
     {
-        assert(size > 1);
-        assert(idx < size);
-        for (int i = idx + 1; i < size; i++) {
-            twigs[i - 1] = std::move(twigs[i]);
-        }
-        twigs[size - 1].~NodeType();
-        size--;
+        return (sizeof(Chunk) + alignof(NodeType) - 1) / alignof(NodeType) * alignof(NodeType);
     }
-public:
-    Branch(uint64_t i, LeafType&& leaf) : index(i), bitmap(0)
+    static constexpr std::size_t chunk_alignment()
     {
-        NybbleType n = nybble_at(leaf.get_key(), i);
-        twig_init_one(std::move(leaf)); //init size. capacity, twigs
-        if (n == NybbleHead) {
-            head = true;
-        } else {
-            head = false;
-            bitmap |= (1 << n);
-        }
+        return std::max(alignof(std::max_align_t), alignof(NodeType));
     }
-    Branch(Branch&& branch) : twigs(branch.twigs), head(branch.head), capacity(branch.capacity), size(branch.size), index(branch.index), bitmap(branch.bitmap)
+    static constexpr std::size_t chunk_size()
     {
-        branch.twigs = nullptr;
+        return std::max<std::size_t>(64 * 1024, chunk_header_size() + NodeType::TwigMax * sizeof(NodeType));
     }
-    Branch(const Branch& branch) = delete;
 
-    Branch& operator= (Branch&& branch)
+    std::pmr::memory_resource* upstream;
+    FreeTwigs* free_lists[NodeType::TwigMax + 1];
+    Chunk* chunks;
+    char* cursor;
+    char* limit;
+    std::unique_ptr<SharedTwigs<NodeType>> sharing; //created by the first snapshot
+
+    void grow()
     {
-        if (twigs != nullptr) {
-            for (int i = 0; i < size; i++) {
-                twigs[i].~NodeType();
-            }
-            std::free(twigs);
+        Chunk* chunk = static_cast<Chunk*>(upstream->allocate(chunk_size(), chunk_alignment()));
+        chunk->next = chunks;
+        chunks = chunk;
+        cursor = reinterpret_cast<char*>(chunk) + chunk_header_size();
+        limit = reinterpret_cast<char*>(chunk) + chunk_size();
+    }
+public:
+    explicit TwigPool(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : upstream(resource), free_lists{}, chunks(nullptr), cursor(nullptr), limit(nullptr) {}
+    TwigPool(TwigPool&& o) : upstream(o.upstream), chunks(o.chunks), cursor(o.cursor), limit(o.limit), sharing(std::move(o.sharing))
+    {
+        std::copy(std::begin(o.free_lists), std::end(o.free_lists), std::begin(free_lists));
+        std::fill(std::begin(o.free_lists), std::end(o.free_lists), nullptr);
+        o.chunks = nullptr;
+        o.cursor = o.limit = nullptr;
+    }
+    TwigPool(const TwigPool&) = delete;
+    TwigPool& operator= (const TwigPool&) = delete;
+    TwigPool& operator= (TwigPool&& o)
+    {
+        if (this != &o) {
+            release();
+            std::copy(std::begin(o.free_lists), std::end(o.free_lists), std::begin(free_lists));
+            std::fill(std::begin(o.free_lists), std::end(o.free_lists), nullptr);
+            upstream = o.upstream;
+            chunks = o.chunks;
+            cursor = o.cursor;
+            limit = o.limit;
+            sharing = std::move(o.sharing);
+            o.chunks = nullptr;
+            o.cursor = o.limit = nullptr;
         }
-        twigs = branch.twigs;
-        head = branch.head;
-        capacity = branch.capacity;
-        size = branch.size;
-        index = branch.index;
-        bitmap = branch.bitmap;
-        branch.twigs = nullptr;
         return *this;
     }
-    ~Branch()
+    ~TwigPool()
     {
-        if (twigs != nullptr) {
-            for (int i = 0; i < size; i++) {
-                twigs[i].~NodeType();
-            }
-            std::free(twigs);
-        }
+        release();
     }
 
-    NybbleIndexType nybble_index() const
+    std::pmr::memory_resource* resource() const
     {
-        return index;
+        return upstream;
     }
-    bool has_head() const
+
+    NodeType* allocate(TwigIndexType capacity)
     {
-        return head;
+        assert(capacity > 0 && capacity <= NodeType::TwigMax);
+        NodeType::CountersType::add(jzt::qp::Counter::TwigAllocations, 1);
+        FreeTwigs* head = free_lists[capacity];
+        if (head != nullptr) {
+            free_lists[capacity] = head->next;
+            return reinterpret_cast<NodeType*>(head);
+        }
+        std::size_t bytes = capacity * sizeof(NodeType);
+        if (static_cast<std::size_t>(limit - cursor) < bytes) {
+            grow();
+        }
+        NodeType* twigs = reinterpret_cast<NodeType*>(cursor);
+        cursor += bytes;
+        return twigs;
     }
-    NodeType* get_head()
+    void deallocate(NodeType* twigs, TwigIndexType capacity)
     {
-        assert(head);
-        return &(twigs[0]);
+        assert(capacity > 0 && capacity <= NodeType::TwigMax);
+        NodeType::CountersType::add(jzt::qp::Counter::TwigFrees, 1);
+        FreeTwigs* head = reinterpret_cast<FreeTwigs*>(twigs);
+        head->next = free_lists[capacity];
+        free_lists[capacity] = head;
     }
-    void remove_head()
+    SharedTwigs<NodeType>* shared_twigs() const
     {
-        assert(head);
-        assert(size > 0);
-        twig_erase_at(0);
-        head = false;
+        return sharing.get();
     }
-    NodeType* twig(TwigIndexType idx)
+    SharedTwigs<NodeType>& make_shared_twigs()
     {
-        assert(idx < size);
-        return &(twigs[idx]);
+        if (!sharing) {
+            sharing = std::make_unique<SharedTwigs<NodeType>>();
+        }
+        return *sharing;
     }
-    TwigIndexType twig_count() const
+    //take back the arrays freed by dropped snapshots
+    void collect_shared()
     {
-        assert((int)__builtin_popcount(bitmap) + head == size);
-        return size;
-    }
+        if (!sharing || !sharing->has_garbage.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(sharing->mutex);
+        for (auto& a : sharing->garbage) {
+            deallocate(a.twigs, a.capacity);
+        }
+        sharing->garbage.clear();
+        sharing->has_garbage.store(false, std::memory_order_relaxed);
+    }
+
+    //drop every chunk at once, twig arrays handed out before are invalid afterwards
+    void release()
+    {
+        //a snapshot alive past its trie would read the chunks freed here
+        if (sharing && sharing->snapshots.load(std::memory_order_acquire) != 0) {
+            std::terminate();
+        }
+        while (chunks != nullptr) {
+            Chunk* next = chunks->next;
+            upstream->deallocate(chunks, chunk_size(), chunk_alignment());
+            chunks = next;
+        }
+        std::fill(std::begin(free_lists), std::end(free_lists), nullptr);
+        cursor = limit = nullptr;
+    }
+    //take over the chunks and free arrays of a pool built on the same upstream resource
+    void merge(TwigPool& o)
+    {
+        if (o.chunks != nullptr) {
+            Chunk* tail = o.chunks;
+            while (tail->next != nullptr) {
+                tail = tail->next;
+            }
+            tail->next = chunks;
+            chunks = o.chunks;
+        }
+        for (int i = 0; i <= NodeType::TwigMax; i++) {
+            while (o.free_lists[i] != nullptr) {
+                FreeTwigs* head = o.free_lists[i];
+                o.free_lists[i] = head->next;
+                head->next = free_lists[i];
+                free_lists[i] = head;
+            }
+        }
+        o.chunks = nullptr;
+        o.cursor = o.limit = nullptr;
+    }
+    //bytes taken from the upstream resource
+    std::size_t reserved_bytes() const
+    {
+        std::size_t n = 0;
+        for (Chunk* chunk = chunks; chunk != nullptr; chunk = chunk->next) {
+            n += chunk_size();
+        }
+        return n;
+    }
+    //bytes of the arrays waiting in the free lists
+    std::size_t free_bytes() const
+    {
+        std::size_t n = 0;
+        for (int i = 0; i <= NodeType::TwigMax; i++) {
+            for (FreeTwigs* head = free_lists[i]; head != nullptr; head = head->next) {
+                n += i * sizeof(NodeType);
+            }
+        }
+        return n;
+    }
+};
+
+//bytes a value owns outside itself, for string like types with data() and capacity()
+template <typename T>
+std::size_t owned_bytes(const T& value)
+{
+    if constexpr (jzt::detail::trait::has_capacity<T>::value) {
+        auto data = reinterpret_cast<const char*>(value.data());
+        auto self = reinterpret_cast<const char*>(&value);
+        if (data >= self && data < self + sizeof(T)) {
+            return 0; //small buffer
+        }
+        return value.capacity() * sizeof(*value.data());
+    } else {
+        return 0;
+    }
+}
+
+//serializes a memory resource so that pools on several threads can share it
+class LockedResource : public std::pmr::memory_resource
+{
+    std::pmr::memory_resource* upstream;
+    std::mutex mutex;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return upstream->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        upstream->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override
+    {
+        return this == &o;
+    }
+public:
+    explicit LockedResource(std::pmr::memory_resource* resource) : upstream(resource) {}
+};
+
+template <typename DataType, bool IsMap, unsigned Bits, typename Summary = jzt::qp::NoSummary, typename Counters = jzt::qp::NoCounters>
+class Node;
+
+//branch words, the 4-bit fan-out packs its bitmap into the first word so a node stays 16 bytes
+template <typename NodeType, unsigned Bits, bool Packed = (Bits == 4)>
+struct BranchFields
+{
+    uint64_t
+        tag : 1, //always 1, shares its bit with Leaf::tag
+        head : 1, //head flag
+        capacity : 9, //twig capacity [0, 2^Bits + 1]
+        size : 9, //twig size [0, 2^Bits] + head
+        index : 44; //nybble index
+    NodeType* twigs;
+    typename Fanout<Bits>::Bitmap bitmap; //twigs bitmap
+};
+template <typename NodeType, unsigned Bits>
+struct BranchFields<NodeType, Bits, true>
+{
+    uint64_t
+        tag : 1, //always 1, shares its bit with Leaf::tag
+        head : 1, //head flag
+        capacity : 5, //twig capacity [0, 17]
+        size : 5, //twig size [0, 16] + head => [0, 17]
+        index : 36, //nybble index
+        bitmap : 16; //twigs bitmap
+    NodeType* twigs;
+};
+
+//leaf count and summary of a branch, nothing without a summary policy and no value for an empty one
+template <typename Summary,
+          bool Counted = !std::is_same_v<Summary, jzt::qp::NoSummary>,
+          bool Valued = !std::is_empty_v<typename Summary::type>>
+struct BranchSummary
+{
+    static_assert(std::is_trivially_copyable_v<typename Summary::type>, "branches are moved with memcpy, the summary type must be trivially copyable");
+
+    uint64_t count;
+    typename Summary::type value;
+
+    typename Summary::type get_value() const
+    {
+        return value;
+    }
+    void set(uint64_t c, const typename Summary::type& v)
+    {
+        count = c;
+        value = v;
+    }
+};
+template <typename Summary>
+struct BranchSummary<Summary, true, false>
+{
+    uint64_t count;
+
+    typename Summary::type get_value() const
+    {
+        return {};
+    }
+    void set(uint64_t c, const typename Summary::type&)
+    {
+        count = c;
+    }
+};
+template <typename Summary, bool Valued>
+struct BranchSummary<Summary, false, Valued> {};
+
+template <typename DataType, bool IsMap, unsigned Bits, typename Summary = jzt::qp::NoSummary, typename Counters = jzt::qp::NoCounters>
+class Branch : private BranchFields<Node<DataType, IsMap, Bits, Summary, Counters>, Bits>, private BranchSummary<Summary> {
+    friend class Node<DataType, IsMap, Bits, Summary, Counters>;
+    using NodeType = Node<DataType, IsMap, Bits, Summary, Counters>;
+    using LeafType = Leaf<DataType, IsMap>;
+    using PoolType = TwigPool<NodeType>;
+    using FanoutType = Fanout<Bits>;
+    using FieldsType = BranchFields<NodeType, Bits>;
+    using SummaryFieldsType = BranchSummary<Summary>;
+    using FieldsType::tag;
+    using FieldsType::head;
+    using FieldsType::capacity;
+    using FieldsType::size;
+    using FieldsType::index;
+    using FieldsType::bitmap;
+    using FieldsType::twigs;
+
+public:
+    using Bitmap = typename FanoutType::Bitmap;
+    static constexpr TwigIndexType TwigMax = FanoutType::twig_max;
+    //nybble indexes the index field can hold
+    static constexpr uint64_t IndexLimit = (uint64_t)1 << (Bits == 4 ? 36 : 44);
+    static constexpr bool Summarized = !std::is_same_v<Summary, jzt::qp::NoSummary>;
+    using SummaryValueType = typename Summary::type;
+
+private:
+
+    //move n twigs from src to dst, src is left uninitialized, the ranges may overlap
+    static void twig_relocate(NodeType* dst, NodeType* src, int n)
+    {
+        if (n <= 0 || dst == src) {
+            return;
+        }
+        if constexpr (NodeType::trivially_relocatable) {
+            std::memmove(static_cast<void*>(dst), static_cast<const void*>(src), n * sizeof(NodeType));
+        } else if (dst < src) {
+            for (int i = 0; i < n; i++) {
+                NodeType::relocate(&dst[i], &src[i]);
+            }
+        } else {
+            for (int i = n - 1; i >= 0; i--) {
+                NodeType::relocate(&dst[i], &src[i]);
+            }
+        }
+    }
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
+    void twig_init_one(PoolType& pool, Args&& ...args)
+    {
+        size = 1;
+        capacity = 2;
+        twigs = pool.allocate(capacity);
+        new (&twigs[0]) NodeType(std::forward<Args>(args)...);
+    }
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
+    void twig_expand_emplace_at(PoolType& pool, TwigIndexType idx, Args&& ...args)
+    {
+        assert(capacity <= TwigMax);
+        Counters::add(jzt::qp::Counter::TwigExpansions, 1);
+        int new_capacity = std::min((int)(capacity * 1.5), (int)TwigMax);
+        NodeType* new_twigs = pool.allocate(new_capacity);
+        new (&new_twigs[idx]) NodeType(std::forward<Args>(args)...);
+        twig_relocate(new_twigs, twigs, idx);
+        twig_relocate(new_twigs + idx + 1, twigs + idx, size - idx);
+        pool.deallocate(twigs, capacity);
+        twigs = new_twigs;
+        size++;
+        capacity = new_capacity;
+    }
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
+    void twig_emplace_at(PoolType& pool, TwigIndexType idx, Args&& ...args)
+    {
+        assert(size < TwigMax);
+        assert(idx <= size);
+        if (size + 1 > capacity) {
+            twig_expand_emplace_at(pool, idx, std::forward<Args>(args)...);
+        } else {
+            twig_relocate(twigs + idx + 1, twigs + idx, size - idx);
+            new (&twigs[idx]) NodeType(std::forward<Args>(args)...);
+            size++;
+        }
+    }
+    template <typename ...Args, std::enable_if_t<std::is_constructible_v<NodeType, Args...>, bool> = true>
+    void twig_emplace_back(PoolType& pool, Args&& ...args)
+    {
+        assert(size < TwigMax);
+        twig_emplace_at(pool, size, std::forward<Args>(args)...);
+    }
+
+    void twig_erase_at(TwigIndexType idx)
+    {
+        assert(size > 1);
+        assert(idx < size);
+        twigs[idx].~NodeType();
+        twig_relocate(twigs + idx, twigs + idx + 1, size - idx - 1);
+        size--;
+    }
+public:
+    Branch(PoolType& pool, uint64_t i, LeafType&& leaf)
+    {
+        tag = 1;
+        index = i;
+        bitmap = Bitmap{};
+        NybbleType n = FanoutType::nybble_at(leaf.key_view(), i);
+        twig_init_one(pool, std::move(leaf)); //init size. capacity, twigs
+        if (n == NybbleHead) {
+            head = true;
+        } else {
+            head = false;
+            bitmap = FanoutType::with(bitmap, n);
+        }
+        summarize();
+    }
+    //adopt a twig array that is already filled
+    Branch(NybbleIndexType i, bool h, Bitmap bm, NodeType* t, TwigIndexType n) : Branch(i, h, bm, t, n, n) {}
+    Branch(NybbleIndexType i, bool h, Bitmap bm, NodeType* t, TwigIndexType n, TwigIndexType cap)
+    {
+        tag = 1;
+        head = h;
+        capacity = cap;
+        size = n;
+        index = i;
+        bitmap = bm;
+        twigs = t;
+        summarize();
+    }
+    Branch(Branch&& branch) : SummaryFieldsType(branch)
+    {
+        tag = 1;
+        head = branch.head;
+        capacity = branch.capacity;
+        size = branch.size;
+        index = branch.index;
+        bitmap = branch.bitmap;
+        twigs = branch.twigs;
+        branch.twigs = nullptr;
+    }
+    Branch(const Branch& branch) = delete;
+
+    //twigs are owned by the pool, a live branch must be destroy()ed before being overwritten
+    Branch& operator= (Branch&& branch)
+    {
+        assert(twigs == nullptr);
+        SummaryFieldsType::operator=(branch);
+        head = branch.head;
+        capacity = branch.capacity;
+        size = branch.size;
+        index = branch.index;
+        bitmap = branch.bitmap;
+        twigs = branch.twigs;
+        branch.twigs = nullptr;
+        return *this;
+    }
+    ~Branch() = default;
+
+    void destroy(PoolType& pool)
+    {
+        if (twigs == nullptr) {
+            return;
+        }
+        for (int i = 0; i < size; i++) {
+            twigs[i].destroy(pool);
+            twigs[i].~NodeType();
+        }
+        pool.deallocate(twigs, capacity);
+        twigs = nullptr;
+    }
+
+    NybbleIndexType nybble_index() const
+    {
+        return index;
+    }
+    bool has_head() const
+    {
+        return head;
+    }
+    NodeType* get_head()
+    {
+        assert(head);
+        return &(twigs[0]);
+    }
+    void remove_head()
+    {
+        assert(head);
+        assert(size > 0);
+        twig_erase_at(0);
+        head = false;
+    }
+    NodeType* twig(TwigIndexType idx)
+    {
+        assert(idx < size);
+        return &(twigs[idx]);
+    }
+    TwigIndexType twig_count() const
+    {
+        assert(FanoutType::count(bitmap) + head == size);
+        return size;
+    }
+    Bitmap twig_bitmap() const
+    {
+        return bitmap;
+    }
+    TwigIndexType twig_capacity() const
+    {
+        return capacity;
+    }
+    uint64_t leaf_count() const
+    {
+        static_assert(Summarized, "leaf counts need a summary policy");
+        return SummaryFieldsType::count;
+    }
+    SummaryValueType summary() const
+    {
+        static_assert(Summarized, "summaries need a summary policy");
+        return SummaryFieldsType::get_value();
+    }
+    //recompute the leaf count and summary from the twigs, after a write below this branch
+    void summarize()
+    {
+        if constexpr (Summarized) {
+            uint64_t c = 0;
+            SummaryValueType v = Summary::identity();
+            for (int i = 0; i < size; i++) {
+                c += NodeType::leaf_count(&twigs[i]);
+                v = Summary::combine(v, NodeType::summary(&twigs[i]));
+            }
+            SummaryFieldsType::set(c, v);
+        }
+    }
+    //copy the twig array if a snapshot shares it, a write below this branch then only touches
+    //arrays owned by the trie alone. the twigs of the copy are copied leaves and branches sharing
+    //their arrays
+    void make_unique(PoolType& pool)
+    {
+        if constexpr (std::is_copy_constructible_v<DataType>) {
+            auto* shared = pool.shared_twigs();
+            if (shared == nullptr || shared->entries.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            if (!shared->is_shared(twigs)) {
+                return;
+            }
+            NodeType* copy = pool.allocate(capacity);
+            for (int i = 0; i < size; i++) {
+                if (twigs[i].is_branch()) {
+                    shared->share(twigs[i].get_branch().twigs);
+                    std::memcpy(static_cast<void*>(&copy[i]), static_cast<const void*>(&twigs[i]), sizeof(NodeType));
+                } else {
+                    new (&copy[i]) NodeType(LeafType(twigs[i].get_leaf()));
+                }
+            }
+            std::vector<TwigArray<NodeType>> freed;
+            shared->release({twigs, (TwigIndexType)size, (TwigIndexType)capacity}, freed);
+            for (auto& a : freed) {
+                pool.deallocate(a.twigs, a.capacity);
+            }
+            twigs = copy;
+        }
+    }
     bool has_twig(NybbleType n)
     {
         assert(n != NybbleHead);
-        return bitmap & (1 << n);
+        return FanoutType::test(bitmap, n);
     }
     NybbleType twig_nybble(std::string_view key) const
     {
-        return nybble_at(key, index);
+        return FanoutType::nybble_at(key, index);
     }
     TwigIndexType twig_index(NybbleType n) const
     {
         assert(n != NybbleHead);
-        return __builtin_popcount(bitmap & ((1 << n) - 1)) + head;
+        return FanoutType::rank(bitmap, n) + head;
+    }
+    //the twig key belongs to, or the first one when key has no twig here
+    NodeType* similar_twig(std::string_view key)
+    {
+        NybbleType n = twig_nybble(key);
+        if (n != NybbleHead && has_twig(n)) {
+            return twig(twig_index(n));
+        }
+        return twig(0);
     }
 
-    void twig_insert(LeafType&& leaf, NybbleType n)
+    void twig_insert(PoolType& pool, LeafType&& leaf, NybbleType n)
     {
         if (n == NybbleHead) {
             assert(!head);
             head = true;
-            twig_emplace_at(0, std::move(leaf));
+            twig_emplace_at(pool, 0, std::move(leaf));
             return;
         }
         assert (!has_twig(n));
         TwigIndexType idx = twig_index(n);
-        twig_emplace_at(idx, std::move(leaf));
-        bitmap |= (1 << n);
+        twig_emplace_at(pool, idx, std::move(leaf));
+        bitmap = FanoutType::with(bitmap, n);
     }
-    void twig_insert(LeafType&& leaf)
+    void twig_insert(PoolType& pool, LeafType&& leaf)
     {
-        NybbleType n = twig_nybble(leaf.get_key());
-        return twig_insert(std::move(leaf), n);
+        NybbleType n = twig_nybble(leaf.key_view());
+        return twig_insert(pool, std::move(leaf), n);
 
     }
-    void twig_insert(Branch&& new_branch, NybbleType n)
+    void twig_insert(PoolType& pool, Branch&& new_branch, NybbleType n)
     {
         TwigIndexType idx = twig_index(n);
-        twig_emplace_at(idx, std::move(new_branch));
-        bitmap |= (1 << n);
+        twig_emplace_at(pool, idx, std::move(new_branch));
+        bitmap = FanoutType::with(bitmap, n);
     }
     void twig_remove(NybbleType n)
     {
         assert(has_twig(n));
         TwigIndexType idx = twig_index(n);
         twig_erase_at(idx);
-        bitmap &= (~(1 << n));
+        bitmap = FanoutType::without(bitmap, n);
     }
 };
 
-template <typename DataType, bool IsMap>
+template <typename DataType, bool IsMap, unsigned Bits, typename Summary, typename Counters>
 class Node
 {
 private:
 
     using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
     using DataTraintsType = typename LeafType::DataTraintsType;
-    using BranchType = jzt::detail::qp::Branch<DataType, IsMap>;
+    using BranchType = jzt::detail::qp::Branch<DataType, IsMap, Bits, Summary, Counters>;
+    using PoolType = jzt::detail::qp::TwigPool<Node>;
+    using FanoutType = jzt::detail::qp::Fanout<Bits>;
 
 public:
     using key_type = typename LeafType::key_type;
@@ -419,182 +1295,537 @@ public:
     using value_type = typename LeafType::value_type;
 
 
-    std::variant<LeafType, BranchType> v;
+    static constexpr bool trivially_relocatable = jzt::qp::is_trivially_relocatable<DataType>::value;
+    static constexpr TwigIndexType TwigMax = FanoutType::twig_max;
+    static constexpr unsigned FanoutBits = Bits;
+    static constexpr bool Summarized = BranchType::Summarized;
+    //the summary depends on the elements, not only on the keys
+    static constexpr bool ValueSummarized = !std::is_empty_v<typename Summary::type>;
+    using SummaryValueType = typename BranchType::SummaryValueType;
+    using CountersType = Counters;
+
+private:
+    union {
+        LeafType leaf;
+        BranchType branch;
+    };
+
+public:
+    //construct dst from src and end the lifetime of src, dst must be uninitialized
+    static void relocate(Node* dst, Node* src)
+    {
+        if (trivially_relocatable || src->is_branch()) {
+            std::memcpy(static_cast<void*>(dst), static_cast<const void*>(src), sizeof(Node));
+        } else {
+            new (dst) Node(std::move(src->leaf));
+            src->~Node();
+        }
+    }
 
     //
     Node* find_similar(std::string_view key)
     {
         Node* node = this;
+        uint64_t visited = 1;
         while (node->is_branch()) {
-            auto& branch = std::get<BranchType>(node->v);
-            NybbleType n = branch.twig_nybble(key);
-            if (n != NybbleHead && branch.has_twig(n)) {
-                TwigIndexType idx = branch.twig_index(n);
-                node = branch.twig(idx);
-            } else {
-                node = branch.twig(0);
-            }
+            node = node->branch.similar_twig(key);
+            visited++;
+        }
+        Counters::add(jzt::qp::Counter::SimilarWalks, 1);
+        Counters::add(jzt::qp::Counter::SimilarNodes, visited);
+        return node;
+    }
+    static std::optional<NybbleIndexType> find_mismatch(std::string_view a, std::string_view b)
+    {
+        std::size_t compared;
+        auto ni_opt = FanoutType::find_mismatch(a, b, compared);
+        Counters::add(jzt::qp::Counter::MismatchBytes, compared);
+        return ni_opt;
+    }
+    Node* first_leaf()
+    {
+        Node* node = this;
+        while (node->is_branch()) {
+            node = node->branch.twig(0);
         }
         return node;
     }
+    static constexpr int BatchWidth = 16;
+    //find_similar for up to BatchWidth keys in lockstep, each key moves one level per round
+    //and its next twig is prefetched a round before it is read, so the cache misses overlap
+    template <typename ForwardIt, typename Visitor>
+    static void find_similar_batch(Node* root, ForwardIt first, ForwardIt last, Visitor&& visit)
+    {
+        //the views are kept for the whole group, so *first must not be a temporary owning its bytes
+        using KeyRef = typename std::iterator_traits<ForwardIt>::reference;
+        static_assert(std::is_reference_v<KeyRef> || std::is_same_v<std::decay_t<KeyRef>, std::string_view>
+                      || std::is_pointer_v<std::decay_t<KeyRef>>,
+                      "batched lookups need iterators to stored keys, string_views or C strings");
+        std::string_view keys[BatchWidth];
+        Node* nodes[BatchWidth];
+        while (first != last) {
+            int count = 0;
+            for (; count < BatchWidth && first != last; ++first, ++count) {
+                keys[count] = std::string_view(*first);
+                nodes[count] = root;
+            }
+            bool active = root->is_branch();
+            uint64_t visited = count;
+            while (active) {
+                active = false;
+                for (int i = 0; i < count; i++) {
+                    if (nodes[i]->is_branch()) {
+                        nodes[i] = nodes[i]->branch.similar_twig(keys[i]);
+                        __builtin_prefetch(nodes[i]);
+                        active = true;
+                        visited++;
+                    }
+                }
+            }
+            Counters::add(jzt::qp::Counter::SimilarWalks, count);
+            Counters::add(jzt::qp::Counter::SimilarNodes, visited);
+            for (int i = 0; i < count; i++) {
+                __builtin_prefetch(nodes[i]->leaf.key_view().data());
+            }
+            for (int i = 0; i < count; i++) {
+                visit(keys[i], nodes[i]);
+            }
+        }
+    }
     template <typename ...Args>
-    void leaf_burst(NybbleIndexType mismatch_index, Args... args)
+    void leaf_burst(PoolType& pool, NybbleIndexType mismatch_index, Args... args)
     {
-        auto& leaf = std::get<LeafType>(v);
-        LeafType saved(std::move(leaf));
-        BranchType branch(mismatch_index, LeafType(std::forward<Args>(args)...));
-        branch.twig_insert(std::move(saved));
-        v.template emplace<BranchType>(std::move(branch));
+        Counters::add(jzt::qp::Counter::LeafBursts, 1);
+        BranchType new_branch(pool, mismatch_index, LeafType(std::forward<Args>(args)...));
+        new_branch.twig_insert(pool, std::move(leaf));
+        new_branch.summarize();
+        leaf.~LeafType();
+        new (&branch) BranchType(std::move(new_branch));
     }
 public:
     bool is_leaf() const
     {
-        return std::holds_alternative<LeafType>(v);
+        return !branch.tag;
     }
     bool is_branch() const
     {
-        return std::holds_alternative<BranchType>(v);
+        return branch.tag;
     }
     BranchType& get_branch()
     {
-        return std::get<BranchType>(v);
+        assert(is_branch());
+        return branch;
     }
     LeafType& get_leaf()
     {
-        return std::get<LeafType>(v);
+        assert(is_leaf());
+        return leaf;
     }
-
-    Node* find(std::string_view key)
+    static uint64_t leaf_count(Node* node)
     {
-        if (is_leaf()) {
-            auto& leaf = std::get<LeafType>(v);
-            if (leaf.get_key() == key) {
-                return this;
+        return node->is_leaf() ? 1 : node->branch.leaf_count();
+    }
+    static SummaryValueType summary(Node* node)
+    {
+        return node->is_leaf() ? Summary::of(node->leaf.get_data()) : node->branch.summary();
+    }
+    //the branches a write went through, their summaries are refreshed deepest first. only the
+    //deepest PathMax are kept, on deeper paths the ones above are found again from the top by the key
+    struct SummaryPath
+    {
+        static constexpr int PathMax = 32;
+        Node* path[PathMax];
+        int depth = 0;
+        std::size_t dropped = 0;
+
+        void push(Node* node)
+        {
+            if (depth == PathMax) {
+                std::copy(path + 1, path + PathMax, path);
+                depth--;
+                dropped++;
             }
-            return nullptr;
+            path[depth++] = node;
         }
-        if (is_branch()) {
-            Node* similar_node = find_similar(key);
-            if (std::get<LeafType>(similar_node->v).get_key() == key) {
-                return similar_node;
+        void pop()
+        {
+            depth--;
+        }
+        void resummarize(Node* top, std::string_view key)
+        {
+            for (int i = depth; i-- > 0;) {
+                path[i]->branch.summarize();
+            }
+            while (dropped > 0) {
+                std::size_t from = dropped > PathMax ? dropped - PathMax : 0;
+                Node* node = top;
+                depth = 0;
+                for (std::size_t i = 0; i < dropped; i++) {
+                    if (i >= from) {
+                        path[depth++] = node;
+                    }
+                    auto& branch = node->branch;
+                    NybbleType n = branch.twig_nybble(key);
+                    node = n == NybbleHead ? branch.get_head() : branch.twig(branch.twig_index(n));
+                }
+                for (int i = depth; i-- > 0;) {
+                    path[i]->branch.summarize();
+                }
+                dropped = from;
             }
         }
-        return nullptr;
-    }
-    bool contains(std::string_view key)
+    };
+
+    Node* find(std::string_view key)
     {
         if (is_leaf()) {
-            auto& leaf = std::get<LeafType>(v);
-            return (leaf.get_key() == key);
+            if (leaf.key_equal(key)) {
+                return this;
+            }
+            return nullptr;
         }
         if (is_branch()) {
             Node* similar_node = find_similar(key);
-            return (std::get<LeafType>(similar_node->v).get_key() == key);
+            if (similar_node->leaf.key_equal(key)) {
+                return similar_node;
+            }
         }
-        return false;
+        return nullptr;
     }
-    bool contains_prefix(std::string_view prefix)
+    bool contains(std::string_view key)
     {
         if (is_leaf()) {
-            auto& leaf = std::get<LeafType>(v);
-            std::string_view leaf_key(leaf.get_key());
-            return (leaf_key.compare(0, prefix.size(), prefix) == 0);
+            return (leaf.key_equal(key));
         }
         if (is_branch()) {
-            Node* similar_node = find_similar(prefix);
-            std::string_view similar_key(std::get<LeafType>(similar_node->v).get_key());
-            return (similar_key.compare(0, prefix.size(), prefix) == 0);
+            Node* similar_node = find_similar(key);
+            return (similar_node->leaf.key_equal(key));
         }
         return false;
     }
+    bool contains_prefix(std::string_view prefix)
+    {
+        TwigIndexType first, last;
+        return get_prefix(prefix, first, last) != nullptr;
+    }
     template <typename ...DataArgs>
-    bool emplace(DataArgs&&... args)
+    bool emplace(PoolType& pool, DataArgs&&... args)
     {
         LeafType new_leaf(std::forward<DataArgs>(args)...);
-        auto key_sv = std::string_view(new_leaf.get_key());
+        auto key_sv = new_leaf.key_view();
         if (is_leaf()) {
-            auto& leaf = std::get<LeafType>(v);
-            auto ni_opt = leaf.find_mismatch(key_sv);
+            auto ni_opt = find_mismatch(leaf.key_view(), key_sv);
             if (!ni_opt) {
                 return false;
             }
-            leaf_burst(*ni_opt, std::move(new_leaf));
+            leaf_burst(pool, *ni_opt, std::move(new_leaf));
             return true;
         }
         if (is_branch()) {
             Node* similar_node = find_similar(key_sv);
-            LeafType& similar_leaf = std::get<LeafType>(similar_node->v);
-            auto ni_opt = similar_leaf.find_mismatch(key_sv);
+            LeafType& similar_leaf = similar_node->leaf;
+            auto ni_opt = find_mismatch(similar_leaf.key_view(), key_sv);
             if (!ni_opt) {
                 return false;
             }
             Node* node = this;
+            SummaryPath path;
             while (node->is_branch()) {
-                auto& branch = std::get<BranchType>(node->v);
+                auto& branch = node->branch;
                 NybbleIndexType branch_ni = branch.nybble_index();
                 NybbleType n = branch.twig_nybble(key_sv);
+                if (branch_ni <= *ni_opt) {
+                    branch.make_unique(pool);
+                }
                 if (branch_ni < *ni_opt) {
+                    if constexpr (Summarized) {
+                        path.push(node);
+                    }
                     TwigIndexType idx = branch.twig_index(n);
                     node = branch.twig(idx);
                     continue;
                 }
                 if (branch_ni == *ni_opt) {
-                    branch.twig_insert(std::move(new_leaf));
-                    return true;
+                    branch.twig_insert(pool, std::move(new_leaf));
+                    branch.summarize();
+                    break;
                 }
                 if (branch_ni > *ni_opt) {
-                    BranchType new_branch(*ni_opt, std::move(new_leaf));
-                    new_branch.twig_insert(std::move(branch), nybble_at(similar_leaf.get_key(), *ni_opt));
-                    node->v.template emplace<BranchType>(std::move(new_branch));
-                    return true;
+                    BranchType new_branch(pool, *ni_opt, std::move(new_leaf));
+                    new_branch.twig_insert(pool, std::move(branch), FanoutType::nybble_at(similar_leaf.key_view(), *ni_opt));
+                    new_branch.summarize();
+                    branch = std::move(new_branch);
+                    break;
                 }
             }
-            node->leaf_burst(*ni_opt, std::move(new_leaf));
+            if (node->is_leaf()) {
+                node->leaf_burst(pool, *ni_opt, std::move(new_leaf));
+            }
+            if constexpr (Summarized) {
+                //key_sv went with new_leaf, a leaf below the kept branches leads through the same dropped ones
+                std::string_view key = path.dropped ? path.path[0]->first_leaf()->leaf.key_view() : std::string_view();
+                path.resummarize(this, key);
+            }
             return true;
         }
         return false;
     }
 
-    Node* get_prefix(std::string_view prefix)
+    //the subtree of the keys starting with prefix, or nullptr when there is none
+    //a prefix ending inside the nybble of a branch matches several of its twigs, then the branch is
+    //returned with the matching twigs in [first, last), otherwise the range covers the whole node
+    Node* get_prefix(std::string_view prefix, TwigIndexType& first, TwigIndexType& last)
     {
-        if (is_leaf()) {
-            auto& leaf = std::get<LeafType>(v);
-            std::string_view sv = leaf.get_key();
-            if (sv.compare(0, prefix.size(), prefix) == 0) {
-                return this;
+        NybbleIndexType whole = FanoutType::nybbles_in(prefix.size());
+        Node* node = this;
+        first = last = 0;
+        while (node->is_branch()) {
+            auto& branch = node->branch;
+            NybbleIndexType ni = branch.nybble_index();
+            NybbleType n = branch.twig_nybble(prefix);
+            if (ni < whole) {
+                if (!branch.has_twig(n)) {
+                    return nullptr;
+                }
+                node = branch.twig(branch.twig_index(n));
+                continue;
+            }
+            if (ni * Bits >= prefix.size() * 8) {
+                first = 0;
+                last = branch.twig_count();
+                break;
+            }
+            //n is padded with zero bits, every value of the padding bits matches
+            unsigned pad = (ni + 1) * Bits - prefix.size() * 8;
+            NybbleType n_max = n | ((1 << pad) - 1);
+            first = branch.twig_index(n);
+            last = branch.twig_index(n_max) + branch.has_twig(n_max);
+            if (first == last) {
+                return nullptr;
+            }
+            if (last - first > 1) {
+                break;
             }
+            node = branch.twig(first);
+            first = last = 0;
+        }
+        //the walk only looked at the nybbles of branches, check the skipped ones on one leaf
+        Node* leaf_node = node->is_leaf() ? node : node->branch.twig(first)->first_leaf();
+        if (leaf_node->leaf.key_view().compare(0, prefix.size(), prefix) != 0) {
             return nullptr;
         }
+        return node;
+    }
+
+    //position it, an iterator over this node, on the first leaf whose key is not less than key
+    //(greater than key when strict). the walk goes down once along the key to where it leaves the
+    //trie and records the branches on the way as the path of the iterator
+    template <typename Cursor>
+    void seek(std::string_view key, bool strict, Cursor& it)
+    {
+        Node* similar = find_similar(key);
+        auto ni_opt = find_mismatch(similar->leaf.key_view(), key);
         Node* node = this;
-        bool has_leaf = false;
-        if (is_branch()) {
-            Node* similar_node = find_similar(prefix);
-            std::string_view sv = std::get<LeafType>(similar_node->v).get_key();
-            if (sv.compare(0, prefix.size(), prefix) != 0) {
-                return nullptr;
-            } else {
-                has_leaf = true;
+        while (node->is_branch() && (!ni_opt || node->branch.nybble_index() < *ni_opt)) {
+            auto& branch = node->branch;
+            NybbleType n = branch.twig_nybble(key);
+            it.push(node);
+            node = branch.twig(n == NybbleHead ? 0 : branch.twig_index(n));
+        }
+        if (!ni_opt) {
+            it.leaf = node;
+            if (strict) {
+                it.next();
             }
-            while (node->is_branch()) {
-                auto& branch = std::get<BranchType>(node->v);
-                if (branch.nybble_index() >= prefix.size() * 2) {
-                    break;
-                } else {
-                    node = branch.twig(branch.twig_index(branch.twig_nybble(prefix)));
+            return;
+        }
+        //the keys below node all differ from key at the mismatch, a head sorts before every nybble
+        auto order = [](NybbleType n) { return n == NybbleHead ? -1 : (int)n; };
+        NybbleType k = FanoutType::nybble_at(key, *ni_opt);
+        if (node->is_branch() && node->branch.nybble_index() == *ni_opt) {
+            //k has no twig here
+            TwigIndexType idx = (k == NybbleHead) ? 0 : node->branch.twig_index(k);
+            if (idx < node->branch.twig_count()) {
+                it.push(node);
+                it.descend_first(node->branch.twig(idx));
+                return;
+            }
+        } else if (order(k) < order(FanoutType::nybble_at(similar->leaf.key_view(), *ni_opt))) {
+            it.descend_first(node);
+            return;
+        }
+        //every key below node is less than key
+        it.descend_last(node);
+        it.next();
+    }
+
+    //calls visit with every leaf whose key is a prefix of key, shortest first, in one walk down
+    //along key. the candidates are the heads on the way and the leaf at its end, plus for a
+    //nybble that straddles a byte boundary the key ending at the boundary, which has zero padding
+    //and so sits in another twig. each candidate is a prefix of the next one, so only the bytes
+    //past the previous one are compared and the walk stops at the first that does not match
+    template <typename Visitor>
+    void visit_prefixes(std::string_view key, Visitor&& visit)
+    {
+        std::size_t verified = 0;
+        auto accept = [&](Node* node) {
+            std::string_view k = node->leaf.key_view();
+            if (k.size() > key.size() || k.compare(verified, k.size() - verified, key, verified, k.size() - verified) != 0) {
+                return false;
+            }
+            verified = k.size();
+            visit(node);
+            return true;
+        };
+        Node* node = this;
+        while (node->is_branch()) {
+            auto& branch = node->branch;
+            if (branch.has_head() && !accept(branch.get_head())) {
+                return;
+            }
+            NybbleType n = branch.twig_nybble(key);
+            if (n == NybbleHead) {
+                return;
+            }
+            uint64_t bit = branch.nybble_index() * Bits;
+            std::size_t boundary = bit / 8 + 1;
+            if (bit % 8 != 0 && boundary * 8 < bit + Bits && key.size() > boundary) {
+                unsigned pad = bit + Bits - boundary * 8;
+                NybbleType padded = n & ~((1 << pad) - 1);
+                if (padded != n && branch.has_twig(padded)) {
+                    Node* shortest = branch.twig(branch.twig_index(padded))->first_leaf();
+                    if (shortest->leaf.key_size() == boundary && !accept(shortest)) {
+                        return;
+                    }
                 }
             }
+            if (!branch.has_twig(n)) {
+                return;
+            }
+            node = branch.twig(branch.twig_index(n));
         }
-        if (node->is_branch()) {
-            return node;
-        } else { //similar leaf
-            if (has_leaf) {
-                return node;
+        accept(node);
+    }
+
+    //the number of leaves and their summary below the twigs [first, last) of this branch
+    uint64_t leaf_count(TwigIndexType first, TwigIndexType last)
+    {
+        uint64_t c = 0;
+        for (TwigIndexType i = first; i < last; i++) {
+            c += leaf_count(branch.twig(i));
+        }
+        return c;
+    }
+    SummaryValueType summary(TwigIndexType first, TwigIndexType last)
+    {
+        SummaryValueType v = Summary::identity();
+        for (TwigIndexType i = first; i < last; i++) {
+            v = Summary::combine(v, summary(branch.twig(i)));
+        }
+        return v;
+    }
+    uint64_t count_prefix(std::string_view prefix)
+    {
+        TwigIndexType first, last;
+        Node* node = get_prefix(prefix, first, last);
+        if (node == nullptr) {
+            return 0;
+        }
+        return node->is_leaf() ? 1 : node->leaf_count(first, last);
+    }
+    SummaryValueType summarize_prefix(std::string_view prefix)
+    {
+        TwigIndexType first, last;
+        Node* node = get_prefix(prefix, first, last);
+        if (node == nullptr) {
+            return Summary::identity();
+        }
+        return node->is_leaf() ? summary(node) : node->summary(first, last);
+    }
+    //the number of leaves whose key is less than key, the same walk as seek with the leaves
+    //of the twigs left of the path added up instead of recorded
+    uint64_t rank(std::string_view key)
+    {
+        Node* similar = find_similar(key);
+        auto ni_opt = find_mismatch(similar->leaf.key_view(), key);
+        uint64_t less = 0;
+        Node* node = this;
+        while (node->is_branch() && (!ni_opt || node->branch.nybble_index() < *ni_opt)) {
+            auto& branch = node->branch;
+            NybbleType n = branch.twig_nybble(key);
+            TwigIndexType idx = (n == NybbleHead) ? 0 : branch.twig_index(n);
+            less += node->leaf_count(0, idx);
+            node = branch.twig(idx);
+        }
+        if (!ni_opt) {
+            return less;
+        }
+        auto order = [](NybbleType n) { return n == NybbleHead ? -1 : (int)n; };
+        NybbleType k = FanoutType::nybble_at(key, *ni_opt);
+        if (node->is_branch() && node->branch.nybble_index() == *ni_opt) {
+            //k has no twig here
+            TwigIndexType idx = (k == NybbleHead) ? 0 : node->branch.twig_index(k);
+            return less + node->leaf_count(0, idx);
+        }
+        if (order(k) < order(FanoutType::nybble_at(similar->leaf.key_view(), *ni_opt))) {
+            return less;
+        }
+        return less + leaf_count(node);
+    }
+    //visits the k leaves with the largest summaries below the twigs [first, last) of this branch,
+    //or this leaf, largest first. with the maximum score as the summary a subtree is a bound on
+    //every leaf below it, a branch is only opened once its bound is the best one left, so the
+    //subtrees that cannot reach the top k are never entered
+    template <typename Visitor>
+    void visit_best(TwigIndexType first, TwigIndexType last, std::size_t k, Visitor&& visit)
+    {
+        struct Bound {
+            SummaryValueType score;
+            Node* node;
+        };
+        auto less = [](const Bound& a, const Bound& b) { return a.score < b.score; };
+        std::vector<Bound> heap;
+        auto push = [&](Node* node) {
+            heap.push_back({summary(node), node});
+            std::push_heap(heap.begin(), heap.end(), less);
+        };
+        if (is_leaf()) {
+            push(this);
+        } else {
+            for (TwigIndexType i = first; i < last; i++) {
+                push(branch.twig(i));
+            }
+        }
+        while (k > 0 && !heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), less);
+            Node* node = heap.back().node;
+            heap.pop_back();
+            if (node->is_leaf()) {
+                visit(node);
+                k--;
+                continue;
+            }
+            for (TwigIndexType i = 0; i < node->branch.twig_count(); i++) {
+                push(node->branch.twig(i));
             }
-            return nullptr;
         }
     }
+    //the leaf with i leaves before it, i must be less than the leaf count of this node
+    Node* select(uint64_t i)
+    {
+        Node* node = this;
+        while (node->is_branch()) {
+            auto& branch = node->branch;
+            TwigIndexType idx = 0;
+            for (uint64_t c; i >= (c = leaf_count(branch.twig(idx))); idx++) {
+                i -= c;
+            }
+            node = branch.twig(idx);
+        }
+        return node;
+    }
 
-    std::pair<bool/*ok*/, bool/*empty*/> remove(std::string_view key)
+    std::pair<bool/*ok*/, bool/*empty*/> remove(PoolType& pool, std::string_view key)
     {
         struct Parent {
             Node* node;
@@ -603,9 +1834,7 @@ public:
         };
         bool empty = false;
         if (is_leaf()) {
-            auto& leaf = std::get<LeafType>(v);
-            std::string_view leaf_key(leaf.get_key());
-            if (leaf_key == key) {
+            if (leaf.key_equal(key)) {
                 empty = true;
                 return {true, empty};
             }
@@ -613,9 +1842,14 @@ public:
         }
         if (is_branch()) {
             Node* node = this;
-            Parent parent;
+            Parent parent{};
+            SummaryPath path;
             while (node->is_branch()) {
-                auto& branch = std::get<BranchType>(node->v);
+                if constexpr (Summarized) {
+                    path.push(node);
+                }
+                auto& branch = node->branch;
+                branch.make_unique(pool);
                 NybbleType n = branch.twig_nybble(key);
                 if (n == NybbleHead) {
                     if (branch.has_head()) {
@@ -635,12 +1869,11 @@ public:
                     return {false, empty};
                 }
             }
-            auto& leaf = std::get<LeafType>(node->v);
-            std::string_view leaf_key(leaf.get_key());
-            if (leaf_key != key) {
+            auto& leaf = node->leaf;
+            if (!leaf.key_equal(key)) {
                 return {false, empty};
             }
-            auto& branch = std::get<BranchType>(parent.node->v);
+            auto& branch = parent.node->branch;
             if (branch.twig_count() > 2) {
                 if (parent.head) {
                     branch.remove_head();
@@ -660,198 +1893,1102 @@ public:
                         another = branch.twig(0);//maybe head
                     }
                 }
-                Node saved(std::move(*another));
-                parent.node->v.swap(saved.v);
+                Counters::add(jzt::qp::Counter::RemoveCollapses, 1);
+                BranchType old(std::move(branch));
+                relocate(parent.node, another);
+                old.twigs[another == old.twigs ? 1 : 0].~Node();
+                pool.deallocate(old.twigs, old.capacity);
+                old.twigs = nullptr;
+                if constexpr (Summarized) {
+                    //the parent was replaced by the other twig, whose summary is already right
+                    path.pop();
+                }
+            }
+            if constexpr (Summarized) {
+                path.resummarize(this, key);
             }
             return {true, empty};
         }
         return {false, empty};
     }
+    //calls f on the mapped value of key and refreshes the summaries above it, false when key is not there
+    template <typename F>
+    bool update(PoolType& pool, std::string_view key, F& f)
+    {
+        Node* node = this;
+        SummaryPath path;
+        while (node->is_branch()) {
+            if constexpr (Summarized) {
+                path.push(node);
+            }
+            auto& branch = node->branch;
+            branch.make_unique(pool);
+            NybbleType n = branch.twig_nybble(key);
+            if (n == NybbleHead) {
+                if (!branch.has_head()) {
+                    return false;
+                }
+                node = branch.get_head();
+            } else if (branch.has_twig(n)) {
+                node = branch.twig(branch.twig_index(n));
+            } else {
+                return false;
+            }
+        }
+        if (!node->leaf.key_equal(key)) {
+            return false;
+        }
+        f(node->leaf.get_data().second);
+        if constexpr (Summarized) {
+            path.resummarize(this, key);
+        }
+        return true;
+    }
+    //return twig arrays of this subtree to the pool
+    void destroy(PoolType& pool)
+    {
+        if (is_branch()) {
+            branch.destroy(pool);
+        }
+    }
     //ctor
-    Node(Node&& node) : v(std::move(node.v)) {}
+    Node(Node&& node)
+    {
+        if (node.is_branch()) {
+            new (&branch) BranchType(std::move(node.branch));
+        } else {
+            new (&leaf) LeafType(std::move(node.leaf));
+        }
+    }
     Node(const Node& node) = delete;
 
     Node& operator= (Node&& node)
     {
-        v = std::move(node.v);
+        if (this != &node) {
+            this->~Node();
+            new (this) Node(std::move(node));
+        }
+        return *this;
+    }
+    Node(BranchType&& b) : branch(std::move(b)) {}
+    Node(LeafType&& l) : leaf(std::move(l)) {}
+
+    template <typename ...LeafArgs, std::enable_if_t<std::is_constructible_v<LeafType, LeafArgs...>, bool> = true>
+    Node(LeafArgs&& ...args) : leaf(std::forward<LeafArgs>(args)...) {}
+
+    ~Node()
+    {
+        if (is_leaf()) {
+            leaf.~LeafType();
+        }
+    }
+};
+
+//builds a trie bottom-up from keys in ascending order
+//an open branch is kept per mismatch index on a stack, its twigs are collected in place
+//and copied into a twig array of the final size once no later key can reach it
+template <typename DataType, bool IsMap, unsigned Bits, typename Summary = jzt::qp::NoSummary, typename Counters = jzt::qp::NoCounters>
+class SortedBuilder
+{
+    using NodeType = Node<DataType, IsMap, Bits, Summary, Counters>;
+    using LeafType = Leaf<DataType, IsMap>;
+    using BranchType = Branch<DataType, IsMap, Bits, Summary, Counters>;
+    using PoolType = TwigPool<NodeType>;
+    using FanoutType = Fanout<Bits>;
+
+    struct Frame
+    {
+        NybbleIndexType index;
+        bool head;
+        typename FanoutType::Bitmap bitmap;
+        TwigIndexType size;
+        NybbleType pending; //nybble of the previous key at index
+        alignas(NodeType) unsigned char storage[NodeType::TwigMax * sizeof(NodeType)];
+
+        explicit Frame(NybbleIndexType i) : index(i), head(false), bitmap{}, size(0), pending(0) {}
+        NodeType* twigs()
+        {
+            return reinterpret_cast<NodeType*>(storage);
+        }
+    };
+
+    PoolType& pool;
+    std::deque<Frame> frames;
+    std::optional<NodeType> cur; //the previous leaf, or the subtree just closed
+
+    void append(Frame& frame, NybbleType n)
+    {
+        assert(frame.size < NodeType::TwigMax);
+        new (&frame.twigs()[frame.size]) NodeType(std::move(*cur));
+        cur.reset();
+        if (n == NybbleHead) {
+            frame.head = true;
+        } else {
+            frame.bitmap = FanoutType::with(frame.bitmap, n);
+        }
+        frame.size++;
+    }
+    void close()
+    {
+        Frame& frame = frames.back();
+        NodeType* twigs = pool.allocate(frame.size);
+        for (int i = 0; i < frame.size; i++) {
+            NodeType::relocate(&twigs[i], &frame.twigs()[i]);
+        }
+        cur.emplace(BranchType(frame.index, frame.head, frame.bitmap, twigs, frame.size));
+        frames.pop_back();
+    }
+public:
+    explicit SortedBuilder(PoolType& p) : pool(p) {}
+    SortedBuilder(const SortedBuilder&) = delete;
+    ~SortedBuilder()
+    {
+        for (auto& frame : frames) {
+            for (int i = 0; i < frame.size; i++) {
+                frame.twigs()[i].destroy(pool);
+                frame.twigs()[i].~NodeType();
+            }
+        }
+        if (cur) {
+            cur->destroy(pool);
+        }
+    }
+
+    template <typename ...Args>
+    void push(Args&& ...args)
+    {
+        LeafType leaf(std::forward<Args>(args)...);
+        if (!cur) {
+            assert(frames.empty());
+            cur.emplace(std::move(leaf));
+            return;
+        }
+        std::string_view prev_key = cur->get_leaf().key_view();
+        std::string_view key = leaf.key_view();
+        auto ni_opt = FanoutType::find_mismatch(prev_key, key);
+        if (!ni_opt) {
+            return; //duplicate, the first one wins as in emplace
+        }
+        NybbleIndexType d = *ni_opt;
+        NybbleType prev_n = FanoutType::nybble_at(prev_key, d);
+        NybbleType n = FanoutType::nybble_at(key, d);
+        if (n == NybbleHead || (prev_n != NybbleHead && prev_n > n)) {
+            throw std::invalid_argument("build_sorted: keys are not in ascending order");
+        }
+        //the previous leaf moves below, take its nybbles while its key is still in place
+        for (auto it = frames.rbegin(); it != frames.rend() && it->index > d; ++it) {
+            it->pending = FanoutType::nybble_at(prev_key, it->index);
+        }
+        while (!frames.empty() && frames.back().index > d) {
+            append(frames.back(), frames.back().pending);
+            close();
+        }
+        if (frames.empty() || frames.back().index < d) {
+            frames.emplace_back(d);
+        }
+        append(frames.back(), prev_n);
+        cur.emplace(std::move(leaf));
+    }
+    void finish(std::optional<NodeType>& root)
+    {
+        if (!cur) {
+            return;
+        }
+        std::string_view last_key = cur->get_leaf().key_view();
+        for (auto& frame : frames) {
+            frame.pending = FanoutType::nybble_at(last_key, frame.index);
+        }
+        while (!frames.empty()) {
+            append(frames.back(), frames.back().pending);
+            close();
+        }
+        root.emplace(std::move(*cur));
+        cur.reset();
+    }
+};
+
+//builds independent subtries of a sorted random access range on several threads
+//the top branches are found by binary search: in a sorted range the common prefix is the one of
+//its first and last key, and the keys under one twig are contiguous
+template <typename DataType, bool IsMap, unsigned Bits, typename Summary = jzt::qp::NoSummary, typename Counters = jzt::qp::NoCounters>
+class ParallelBuilder
+{
+    using NodeType = Node<DataType, IsMap, Bits, Summary, Counters>;
+    using BranchType = Branch<DataType, IsMap, Bits, Summary, Counters>;
+    using PoolType = TwigPool<NodeType>;
+    using FanoutType = Fanout<Bits>;
+
+    struct Part
+    {
+        std::size_t lo;
+        std::size_t hi;
+        bool split;
+        NybbleIndexType index;
+        bool head;
+        typename FanoutType::Bitmap bitmap;
+        std::vector<Part> parts;
+        std::size_t task;
+    };
+
+    PoolType& pool;
+    std::size_t grain;
+    std::vector<std::pair<std::size_t, std::size_t>> tasks;
+    std::vector<std::optional<NodeType>> results;
+    std::vector<PoolType> pools;
+
+    template <typename T>
+    static std::string_view element_key(const T& e)
+    {
+        if constexpr (IsMap) {
+            return std::string_view(e.first);
+        } else {
+            return std::string_view(e);
+        }
+    }
+    static int nybble_order(NybbleType n)
+    {
+        return n == NybbleHead ? -1 : n;
+    }
+
+    template <typename RandomIt>
+    Part plan(RandomIt first, std::size_t lo, std::size_t hi)
+    {
+        Part part{lo, hi, false, 0, false, {}, {}, 0};
+        std::string_view lo_key = element_key(first[lo]);
+        std::string_view hi_key = element_key(first[hi - 1]);
+        auto ni_opt = FanoutType::find_mismatch(lo_key, hi_key);
+        if (hi - lo <= grain || !ni_opt) {
+            part.task = tasks.size();
+            tasks.emplace_back(lo, hi);
+            return part;
+        }
+        NybbleIndexType d = *ni_opt;
+        //the splitting below relies on the order, unsorted input could otherwise leave a range as it is
+        //and recurse on it forever
+        if (nybble_order(FanoutType::nybble_at(hi_key, d)) < nybble_order(FanoutType::nybble_at(lo_key, d))) {
+            throw std::invalid_argument("build_sorted: keys are not in ascending order");
+        }
+        part.split = true;
+        part.index = d;
+        std::size_t begin = lo;
+        while (begin < hi) {
+            NybbleType n = FanoutType::nybble_at(element_key(first[begin]), d);
+            std::size_t end = std::partition_point(first + begin, first + hi, [&](const auto& e) {
+                return nybble_order(FanoutType::nybble_at(element_key(e), d)) <= nybble_order(n);
+            }) - first;
+            if (end == begin || (begin == lo && end == hi)) {
+                throw std::invalid_argument("build_sorted: keys are not in ascending order");
+            }
+            if (n == NybbleHead) {
+                part.head = true;
+            } else {
+                part.bitmap = FanoutType::with(part.bitmap, n);
+            }
+            part.parts.push_back(plan(first, begin, end));
+            begin = end;
+        }
+        return part;
+    }
+    NodeType assemble(Part& part)
+    {
+        if (!part.split) {
+            NodeType node(std::move(*results[part.task]));
+            results[part.task].reset();
+            return node;
+        }
+        TwigIndexType size = part.parts.size();
+        NodeType* twigs = pool.allocate(size);
+        for (TwigIndexType i = 0; i < size; i++) {
+            new (&twigs[i]) NodeType(assemble(part.parts[i]));
+        }
+        return NodeType(BranchType(part.index, part.head, part.bitmap, twigs, size));
+    }
+public:
+    ParallelBuilder(PoolType& p, std::size_t g) : pool(p), grain(g) {}
+    ~ParallelBuilder()
+    {
+        for (std::size_t i = 0; i < results.size(); i++) {
+            if (results[i]) {
+                results[i]->destroy(pools[i]);
+            }
+        }
+    }
+
+    template <typename RandomIt>
+    void build(RandomIt first, RandomIt last, unsigned threads, std::optional<NodeType>& root)
+    {
+        std::size_t n = last - first;
+        if (n == 0) {
+            return;
+        }
+        Part top = plan(first, 0, n);
+
+        LockedResource shared(pool.resource());
+        results.resize(tasks.size());
+        pools.reserve(tasks.size());
+        for (std::size_t i = 0; i < tasks.size(); i++) {
+            pools.emplace_back(&shared);
+        }
+        std::atomic<std::size_t> next(0);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto work = [&]() {
+            for (std::size_t t = next++; t < tasks.size(); t = next++) {
+                try {
+                    auto [lo, hi] = tasks[t];
+                    //the pair across the task boundary is checked by the task on its right
+                    if (lo > 0 && !(element_key(first[lo - 1]) <= element_key(first[lo]))) {
+                        throw std::invalid_argument("build_sorted: keys are not in ascending order");
+                    }
+                    SortedBuilder<DataType, IsMap, Bits, Summary, Counters> builder(pools[t]);
+                    for (std::size_t i = lo; i < hi; i++) {
+                        builder.push(first[i]);
+                    }
+                    builder.finish(results[t]);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    error = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        unsigned count = std::min<std::size_t>(threads, tasks.size());
+        for (unsigned i = 1; i < count; i++) {
+            try {
+                workers.emplace_back(work);
+            } catch (...) {
+                //the workers already started still have to be joined and their results freed, the
+                //error is rethrown after that like one thrown by a task
+                std::lock_guard<std::mutex> lock(error_mutex);
+                error = std::current_exception();
+                break;
+            }
+        }
+        work();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (auto& p : pools) {
+            pool.merge(p);
+        }
+        if (error) {
+            for (auto& result : results) {
+                if (result) {
+                    result->destroy(pool);
+                    result.reset();
+                }
+            }
+            std::rethrow_exception(error);
+        }
+        root.emplace(assemble(top));
+    }
+};
+
+//levenshtein search, depth first with one dynamic programming row per key byte. the keys below a
+//branch share the bytes before its nybble index, so a node extends the rows of its parent up to
+//there with the key of any leaf below it, and a nybble that splits a byte never needs a row of its
+//own. a subtree is left as soon as every entry of its last row is over the bound
+template <typename NodeType>
+class FuzzySearch
+{
+    std::string_view query;
+    unsigned bound;
+    std::size_t width;
+    std::vector<unsigned> rows; //row r holds the distances of the query prefixes to r key bytes
+
+    unsigned* row(std::size_t r)
+    {
+        return rows.data() + r * width;
+    }
+    //rows up to byte to of key, false once a row is over the bound everywhere
+    bool extend(std::string_view key, std::size_t from, std::size_t to)
+    {
+        if (rows.size() < (to + 1) * width) {
+            rows.resize((to + 1) * width);
+        }
+        for (std::size_t r = from; r < to; r++) {
+            const unsigned* prev = row(r);
+            unsigned* cur = row(r + 1);
+            unsigned char b = key[r];
+            cur[0] = prev[0] + 1;
+            unsigned best = cur[0];
+            for (std::size_t i = 1; i < width; i++) {
+                unsigned replace = prev[i - 1] + ((unsigned char)query[i - 1] != b);
+                cur[i] = std::min({prev[i] + 1, cur[i - 1] + 1, replace});
+                best = std::min(best, cur[i]);
+            }
+            if (best > bound) {
+                return false;
+            }
+        }
+        return true;
+    }
+public:
+    FuzzySearch(std::string_view q, unsigned b) : query(q), bound(b), width(q.size() + 1), rows(width)
+    {
+        for (std::size_t i = 0; i < width; i++) {
+            rows[i] = i;
+        }
+    }
+    //visit(leaf, distance) for the leaves below node within the bound, in key order. depth is the
+    //number of key bytes the rows already cover
+    template <typename Visitor>
+    void run(NodeType* node, std::size_t depth, Visitor&& visit)
+    {
+        if (node->is_leaf()) {
+            std::string_view key = node->get_leaf().key_view();
+            if (extend(key, depth, key.size()) && row(key.size())[width - 1] <= bound) {
+                visit(node, row(key.size())[width - 1]);
+            }
+            return;
+        }
+        auto& branch = node->get_branch();
+        std::size_t common = branch.nybble_index() * NodeType::FanoutBits / 8;
+        if (common > depth && !extend(node->first_leaf()->get_leaf().key_view(), depth, common)) {
+            return;
+        }
+        for (TwigIndexType i = 0; i < branch.twig_count(); i++) {
+            run(branch.twig(i), common, visit);
+        }
+    }
+};
+
+//walks a trie in step with a byte automaton such as Pattern (Pattern.hpp), which provides
+//start(), next(state, byte), accepts(state) and dead(state). the states are kept per key byte and
+//advanced like the rows of FuzzySearch. a twig is only entered when some byte its nybble allows
+//leads to a state that is not dead, so the subtrees outside the matching region are never visited
+template <typename NodeType, typename Automaton>
+class AutomatonSearch
+{
+    using FanoutType = Fanout<NodeType::FanoutBits>;
+    using StateType = decltype(std::declval<const Automaton&>().start());
+
+    static constexpr unsigned Bits = NodeType::FanoutBits;
+
+    const Automaton& automaton;
+    std::vector<StateType> states; //the state after r key bytes
+
+    bool extend(std::string_view key, std::size_t from, std::size_t to)
+    {
+        if (states.size() < to + 1) {
+            states.resize(to + 1);
+        }
+        for (std::size_t r = from; r < to; r++) {
+            StateType s = automaton.next(states[r], key[r]);
+            if (automaton.dead(s)) {
+                return false;
+            }
+            states[r + 1] = s;
+        }
+        return true;
+    }
+    //whether a key with nybble n at the nybble index of branch can still match. only the byte the
+    //nybble starts in is checked, its bits before the nybble are those of key
+    bool viable(std::string_view key, NybbleIndexType index, NybbleType n)
+    {
+        uint64_t bit = index * Bits;
+        std::size_t at = bit / 8;
+        unsigned known = bit % 8;
+        unsigned taken = std::min(Bits, 8 - known);
+        unsigned free = 8 - known - taken;
+        unsigned byte = at < key.size() ? (unsigned char)key[at] : 0;
+        unsigned lo = (byte & (0xFF00 >> known)) | ((n >> (Bits - taken)) << free);
+        for (unsigned b = lo; b < lo + (1u << free); b++) {
+            if (!automaton.dead(automaton.next(states[at], b))) {
+                return true;
+            }
+        }
+        return false;
+    }
+public:
+    explicit AutomatonSearch(const Automaton& a) : automaton(a), states(1, a.start()) {}
+
+    //visit(leaf) for the leaves below node whose keys are accepted, in key order. depth is the
+    //number of key bytes the states already cover
+    template <typename Visitor>
+    void run(NodeType* node, std::size_t depth, Visitor&& visit)
+    {
+        if (automaton.dead(states[depth])) {
+            return;
+        }
+        if (node->is_leaf()) {
+            std::string_view key = node->get_leaf().key_view();
+            if (extend(key, depth, key.size()) && automaton.accepts(states[key.size()])) {
+                visit(node);
+            }
+            return;
+        }
+        auto& branch = node->get_branch();
+        NybbleIndexType index = branch.nybble_index();
+        std::size_t common = index * Bits / 8;
+        //the bytes before the nybble, the same in every key below
+        std::string_view key;
+        if (common > depth || index * Bits % 8 != 0) {
+            key = node->first_leaf()->get_leaf().key_view();
+        }
+        if (!extend(key, depth, common)) {
+            return;
+        }
+        if (branch.has_head()) {
+            run(branch.get_head(), common, visit);
+        }
+        for (NybbleType n = 0; n < (1 << Bits); n++) {
+            if (branch.has_twig(n) && viable(key, index, n)) {
+                run(branch.twig(branch.twig_index(n)), common, visit);
+            }
+        }
+    }
+};
+
+//lets code outside a container walk its nodes, see MappedTrie.hpp
+struct RootAccess
+{
+    template <typename Container>
+    static auto root(const Container& c)
+    {
+        return c.root ? const_cast<typename Container::NodeType*>(&(c.root.value())) : nullptr;
+    }
+};
+
+//an iterator is its leaf and the branches above it. the deepest PathMax branches are kept inline,
+//the ones above are found again by walking down from top along the key of the leaf, so iterators
+//never allocate. iterators made by find start without a path and walk down only when they move
+template <typename NodeType>
+struct IteratorBase
+{
+    static constexpr int PathMax = 32;
+
+    NodeType* top; //the subtree iterated, only the twigs [first, last) when it is a branch
+    NodeType* leaf; //nullptr at the end
+    TwigIndexType first;
+    TwigIndexType last;
+    int depth;
+    NodeType* path[PathMax]; //path[depth - 1] is the parent of leaf
+
+    void push(NodeType* branch)
+    {
+        if (depth == PathMax) {
+            std::copy(path + 1, path + PathMax, path);
+            depth--;
+        }
+        path[depth++] = branch;
+    }
+    TwigIndexType twig_begin(NodeType* branch) const
+    {
+        return branch == top ? first : 0;
+    }
+    TwigIndexType twig_end(NodeType* branch) const
+    {
+        return branch == top ? last : branch->get_branch().twig_count();
+    }
+    void descend_first(NodeType* node)
+    {
+        while (node->is_branch()) {
+            push(node);
+            node = node->get_branch().twig(twig_begin(node));
+        }
+        leaf = node;
+    }
+    void descend_last(NodeType* node)
+    {
+        while (node->is_branch()) {
+            push(node);
+            node = node->get_branch().twig(twig_end(node) - 1);
+        }
+        leaf = node;
+    }
+    //refill path with the branches from top down to node, which lies above leaf
+    void rebuild(NodeType* node)
+    {
+        std::string_view key = leaf->get_leaf().key_view();
+        depth = 0;
+        for (NodeType* cur = top; cur != node; ) {
+            push(cur);
+            auto& branch = cur->get_branch();
+            NybbleType n = branch.twig_nybble(key);
+            cur = branch.twig(n == NybbleHead ? 0 : branch.twig_index(n));
+        }
+    }
+    void next()
+    {
+        for (NodeType* child = leaf; child != top; ) {
+            if (depth == 0) {
+                rebuild(child);
+            }
+            NodeType* parent = path[depth - 1];
+            TwigIndexType idx = child - parent->get_branch().twig(0);
+            if (idx + 1 < twig_end(parent)) {
+                descend_first(parent->get_branch().twig(idx + 1));
+                return;
+            }
+            depth--;
+            child = parent;
+        }
+        leaf = nullptr;
+        depth = 0;
+    }
+    //from the end to the last leaf
+    void prev()
+    {
+        if (leaf == nullptr) {
+            if (top != nullptr) {
+                descend_last(top);
+            }
+            return;
+        }
+        for (NodeType* child = leaf; child != top; ) {
+            if (depth == 0) {
+                rebuild(child);
+            }
+            NodeType* parent = path[depth - 1];
+            TwigIndexType idx = child - parent->get_branch().twig(0);
+            if (idx > twig_begin(parent)) {
+                descend_last(parent->get_branch().twig(idx - 1));
+                return;
+            }
+            depth--;
+            child = parent;
+        }
+        leaf = nullptr;
+        depth = 0;
+    }
+
+    IteratorBase() : top(nullptr), leaf(nullptr), first(0), last(0), depth(0) {}
+    //the leaves of the twigs [f, l) of top
+    IteratorBase(NodeType* t, TwigIndexType f, TwigIndexType l) : top(t), leaf(nullptr), first(f), last(l), depth(0)
+    {
+        descend_first(top);
+    }
+    //positioned on l below t, the end when l is nullptr
+    IteratorBase(NodeType* t, NodeType* l) : top(t), leaf(l), first(0), last(0), depth(0)
+    {
+        if (top != nullptr && top->is_branch()) {
+            last = top->get_branch().twig_count();
+        }
+    }
+    IteratorBase(const IteratorBase& o) : top(o.top), leaf(o.leaf), first(o.first), last(o.last), depth(o.depth)
+    {
+        std::copy(o.path, o.path + o.depth, path);
+    }
+    IteratorBase& operator=(const IteratorBase& o)
+    {
+        top = o.top;
+        leaf = o.leaf;
+        first = o.first;
+        last = o.last;
+        depth = o.depth;
+        std::copy(o.path, o.path + o.depth, path);
+        return *this;
+    }
+
+    bool operator==(const IteratorBase& rhs) const
+    {
+        return leaf == rhs.leaf;
+    }
+    bool operator!=(const IteratorBase& rhs) const
+    {
+        return !(operator==(rhs));
+    }
+};
+
+} //namespace jzt::detail::qp
+
+} //namespace jzt::detail
+
+namespace qp {
+
+template <typename NodeType>
+class Iterator;
+
+template <typename NodeType>
+class ConstIterator;
+
+template <typename NodeType>
+class Iterator : public jzt::detail::qp::IteratorBase<NodeType>
+{
+private:
+    using IteratorBaseType = jzt::detail::qp::IteratorBase<NodeType>;
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename NodeType::value_type;
+    using difference_type = std::ptrdiff_t;
+    //elements are read only when the summaries depend on them, they are changed with Trie::update
+    using pointer = std::conditional_t<NodeType::ValueSummarized, const value_type*, value_type*>;
+    using reference = std::conditional_t<NodeType::ValueSummarized, const value_type&, value_type&>;
+
+    Iterator() {}
+    //every leaf below root
+    Iterator(NodeType* root) : IteratorBaseType(root, 0, root->is_branch() ? root->get_branch().twig_count() : 0) {}
+    Iterator(NodeType* branch, jzt::detail::qp::TwigIndexType first, jzt::detail::qp::TwigIndexType last) : IteratorBaseType(branch, first, last) {}
+    //at leaf, iteration goes on over the rest of root
+    Iterator(NodeType* root, NodeType* leaf) : IteratorBaseType(root, leaf) {}
+
+    reference operator*() const
+    {
+        return this->leaf->get_leaf().get_data();
+    }
+    pointer operator->() const
+    {
+        return &(operator*());
+    }
+    Iterator& operator++()
+    {
+        IteratorBaseType::next();
+        return *this;
+    }
+    Iterator operator++(int)
+    {
+        Iterator tmp(*this);
+        IteratorBaseType::next();
+        return tmp;
+    }
+    Iterator& operator--()
+    {
+        IteratorBaseType::prev();
+        return *this;
+    }
+    Iterator operator--(int)
+    {
+        Iterator tmp(*this);
+        IteratorBaseType::prev();
+        return tmp;
+    }
+    using IteratorBaseType::operator==;
+    using IteratorBaseType::operator!=;
+
+};
+
+template <typename NodeType>
+class ConstIterator : public jzt::detail::qp::IteratorBase<NodeType>
+{
+private:
+    using IteratorBaseType = jzt::detail::qp::IteratorBase<NodeType>;
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename NodeType::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    ConstIterator() {}
+    ConstIterator(NodeType* root) : IteratorBaseType(root, 0, root->is_branch() ? root->get_branch().twig_count() : 0) {}
+    ConstIterator(NodeType* branch, jzt::detail::qp::TwigIndexType first, jzt::detail::qp::TwigIndexType last) : IteratorBaseType(branch, first, last) {}
+    ConstIterator(NodeType* root, NodeType* leaf) : IteratorBaseType(root, leaf) {}
+
+    reference operator*() const
+    {
+        return this->leaf->get_leaf().get_data();
+    }
+    pointer operator->() const
+    {
+        return &(operator*());
+    }
+    ConstIterator& operator++()
+    {
+        IteratorBaseType::next();
+        return *this;
+    }
+    ConstIterator operator++(int)
+    {
+        ConstIterator tmp(*this);
+        IteratorBaseType::next();
+        return tmp;
+    }
+    ConstIterator& operator--()
+    {
+        IteratorBaseType::prev();
+        return *this;
+    }
+    ConstIterator operator--(int)
+    {
+        ConstIterator tmp(*this);
+        IteratorBaseType::prev();
+        return tmp;
+    }
+};
+
+template <typename DataType, bool IsMap, unsigned Bits, typename Summary, typename Counters>
+class Trie;
+
+//the shape and memory of a trie, see Trie::stats(). histograms are indexed by the value they count
+struct TrieStats
+{
+    uint64_t leaves = 0;
+    uint64_t branches = 0;
+    uint64_t head_twigs = 0;
+    std::vector<uint64_t> leaf_depths; //leaves per depth, a root leaf is at depth 0
+    std::vector<uint64_t> fanouts; //branches per twig count
+    std::vector<std::vector<uint64_t>> capacities; //[size][capacity], twig arrays per capacity for each size
+    uint64_t twig_bytes = 0; //twig arrays of the trie
+    uint64_t slack_bytes = 0; //unused slots in them, from growing arrays by 1.5x
+    uint64_t key_bytes = 0; //key lengths
+    uint64_t heap_bytes = 0; //allocated by keys and values themselves, strings beyond their small buffer
+    uint64_t pool_bytes = 0; //chunks the twig pool took from its memory resource
+    uint64_t free_bytes = 0; //freed twig arrays in the pool waiting for reuse
+};
+
+//an immutable view of a trie at the time Trie::snapshot() was called
+//it shares its twig arrays with the trie, the trie copies an array before writing to it while a
+//snapshot still refers to it. a snapshot can be read and dropped on any thread, it must be dropped
+//before its trie is destroyed or std::terminate is called
+template <typename DataType, bool IsMap, unsigned Bits = 4, typename Summary = NoSummary, typename Counters = NoCounters>
+class Snapshot
+{
+    friend class Trie<DataType, IsMap, Bits, Summary, Counters>;
+    friend struct jzt::detail::qp::RootAccess;
+
+    using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
+    using NodeType = jzt::detail::qp::Node<DataType, IsMap, Bits, Summary, Counters>;
+    using BranchType = jzt::detail::qp::Branch<DataType, IsMap, Bits, Summary, Counters>;
+    using SharedType = jzt::detail::qp::SharedTwigs<NodeType>;
+
+public:
+    using ConstIteratorType = ConstIterator<NodeType>;
+    using ConstReverseIteratorType = std::reverse_iterator<ConstIteratorType>;
+
+private:
+    SharedType* shared;
+    std::optional<NodeType> root;
+
+    //called by the trie with shared->mutex held
+    Snapshot(SharedType* s, NodeType* r) : shared(s)
+    {
+        shared->snapshots.fetch_add(1, std::memory_order_relaxed);
+        if (r == nullptr) {
+            return;
+        }
+        if (r->is_leaf()) {
+            root.emplace(LeafType(r->get_leaf()));
+            return;
+        }
+        auto& branch = r->get_branch();
+        shared->share(branch.twig(0));
+        root.emplace(BranchType(branch.nybble_index(), branch.has_head(), branch.twig_bitmap(),
+                                branch.twig(0), branch.twig_count(), branch.twig_capacity()));
+    }
+    NodeType* top() const
+    {
+        return const_cast<NodeType*>(&(root.value()));
+    }
+    void reset()
+    {
+        if (shared == nullptr) {
+            return;
+        }
+        if (root && root->is_branch()) {
+            auto& branch = root->get_branch();
+            std::vector<jzt::detail::qp::TwigArray<NodeType>> freed;
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->release({branch.twig(0), branch.twig_count(), branch.twig_capacity()}, freed);
+            if (!freed.empty()) {
+                shared->garbage.insert(shared->garbage.end(), freed.begin(), freed.end());
+                shared->has_garbage.store(true, std::memory_order_release);
+            }
+        }
+        root.reset();
+        shared->snapshots.fetch_sub(1, std::memory_order_release);
+        shared = nullptr;
+    }
 
+public:
+    Snapshot() : shared(nullptr) {}
+    Snapshot(Snapshot&& o) : shared(o.shared), root(std::move(o.root))
+    {
+        o.root.reset();
+        o.shared = nullptr;
+    }
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator= (const Snapshot&) = delete;
+    Snapshot& operator= (Snapshot&& o)
+    {
+        if (this != &o) {
+            reset();
+            shared = o.shared;
+            root = std::move(o.root);
+            o.root.reset();
+            o.shared = nullptr;
+        }
         return *this;
     }
-    Node(BranchType&& branch) : v(std::move(branch)) {}
-    Node(LeafType&& leaf) : v(std::move(leaf)) {}
-
-    template <typename ...LeafArgs>
-    Node(LeafArgs&& ...args) : v(LeafType(std::forward<LeafArgs>(args)...)) {}
-};
-
-template <typename NodeType>
-struct IteratorBase
-{
-    std::stack<NodeType*> stk;
+    ~Snapshot()
+    {
+        reset();
+    }
 
-    NodeType* next_leaf()
+    ConstIteratorType begin() const
     {
-        if (stk.empty()) return nullptr;
-        if (stk.top()->is_leaf()) stk.pop();
-        NodeType* node = nullptr;
-        while (!stk.empty()) {
-            node = stk.top();
-            if (node->is_leaf()) break;
-            stk.pop();
-            auto& branch = node->get_branch();
-            auto sz = branch.twig_count();
-            assert(sz >= 2);
-            sz -= 1;
-            for (int i = sz; i >= 0; i-- ) {
-                stk.push(branch.twig(i));
-            }
+        if (!root) {
+            return {};
         }
-        return node;
+        return ConstIteratorType(top());
     }
-
-    IteratorBase() = default;
-    IteratorBase(const IteratorBase& o) : stk(o.stk) {}
-    IteratorBase(IteratorBase&& o) : stk(o.stk) {}
-
-    bool operator==(const IteratorBase& rhs) const
+    ConstIteratorType end() const
     {
-        if (stk.empty() && rhs.stk.empty()) return true;
-        if (!stk.empty() && !rhs.stk.empty()) return stk.top() == rhs.stk.top();
-        return false;
+        return ConstIteratorType(root ? top() : nullptr, nullptr);
     }
-    bool operator!=(const IteratorBase& rhs) const
+    ConstReverseIteratorType rbegin() const
     {
-        return !(operator==(rhs));
+        return ConstReverseIteratorType(end());
     }
-};
-
-} //namespace jzt::detail::qp
-
-} //namespace jzt::detail
-
-namespace qp {
-
-template <typename NodeType>
-class Iterator;
-
-template <typename NodeType>
-class ConstIterator;
-
-template <typename NodeType>
-class Iterator : public jzt::detail::qp::IteratorBase<NodeType>
-{
-private:
-    using value_type = typename NodeType::value_type;
-    using ConstIteratorType = ConstIterator<NodeType>;
-    using IteratorBaseType = jzt::detail::qp::IteratorBase<NodeType>;
-public:
-    Iterator() {}
-    Iterator(NodeType* root)
+    ConstReverseIteratorType rend() const
     {
-        this->stk.push(root);
-        if (root->is_branch()) {
-            IteratorBaseType::next_leaf();
-        }
+        return ConstReverseIteratorType(begin());
     }
-    Iterator(const Iterator& o) : IteratorBaseType(o)   {}
-    Iterator(Iterator&& o) : IteratorBaseType(std::move(o)) {}
-
-    Iterator& operator=(const Iterator& o)
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    ConstIteratorType find(const T& key) const
     {
-        this->stk = o.stk;
-        return *this;
+        if (!root) {
+            return {};
+        }
+        NodeType* node = top()->find(std::string_view(key));
+        if (node == nullptr) return {};
+        return ConstIteratorType(top(), node);
     }
-    Iterator& operator=(Iterator&& o)
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    ConstIteratorType prefix(const T& prefix) const
     {
-        this->stk = std::move(o.stk);
-        return *this;
+        if (!root) {
+            return {};
+        }
+        jzt::detail::qp::TwigIndexType first, last;
+        NodeType* node = top()->get_prefix(std::string_view(prefix), first, last);
+        if (node == nullptr) return {};
+        if (node->is_leaf()) return ConstIteratorType(node);
+        return ConstIteratorType(node, first, last);
     }
-
-    value_type& operator*()
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    ConstIteratorType lower_bound(const T& key) const
     {
-        NodeType* node = nullptr;
-        node = this->stk.top();
-        return node->get_leaf().get_data();
+        if (!root) {
+            return {};
+        }
+        ConstIteratorType it(top(), nullptr);
+        top()->seek(std::string_view(key), false, it);
+        return it;
     }
-    value_type* operator->()
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    ConstIteratorType upper_bound(const T& key) const
     {
-        return &(operator*());
+        if (!root) {
+            return {};
+        }
+        ConstIteratorType it(top(), nullptr);
+        top()->seek(std::string_view(key), true, it);
+        return it;
     }
-    Iterator& operator++()
+    //the keys in [from, to)
+    template <typename T, typename U, std::enable_if_t<std::is_convertible_v<T, std::string_view> && std::is_convertible_v<U, std::string_view>, bool> = true>
+    std::pair<ConstIteratorType, ConstIteratorType> range(const T& from, const U& to) const
     {
-        IteratorBaseType::next_leaf();
-        return *this;
+        return {lower_bound(from), lower_bound(to)};
     }
-    Iterator operator++(int)
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    ConstIteratorType longest_prefix_match(const T& key) const
     {
-        Iterator tmp(*this);
-        IteratorBaseType::next_leaf();
-        return tmp;
+        if (!root) {
+            return {};
+        }
+        NodeType* found = nullptr;
+        top()->visit_prefixes(std::string_view(key), [&](NodeType* node) { found = node; });
+        if (found == nullptr) return {};
+        return ConstIteratorType(top(), found);
     }
-    using IteratorBaseType::operator==;
-    using IteratorBaseType::operator!=;
-
-};
-
-template <typename NodeType>
-class ConstIterator : public jzt::detail::qp::IteratorBase<NodeType>
-{
-private:
-    using value_type = typename NodeType::value_type;
-    using IteratorType = Iterator<NodeType>;
-    using IteratorBaseType = jzt::detail::qp::IteratorBase<NodeType>;
-public:
-    ConstIterator() {}
-    ConstIterator(NodeType* root)
+    template <typename T, typename F, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    void for_each_prefix_of(const T& key, F&& f) const
     {
-        this->stk.push(root);
-        if (root->is_branch()) {
-            IteratorBaseType::next_leaf();
+        if (!root) {
+            return;
         }
+        top()->visit_prefixes(std::string_view(key), [&](NodeType* node) {
+            const auto& data = node->get_leaf().get_data();
+            f(data);
+        });
     }
-    ConstIterator(const ConstIterator& o) : IteratorBaseType(o) {}
-    ConstIterator(ConstIterator&& o) : IteratorBaseType(std::move(o)) {}
-
-    ConstIterator& operator=(const ConstIterator& o)
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    uint64_t count_prefix(const T& prefix) const
     {
-        this->stk = o.stk;
-        return *this;
+        static_assert(NodeType::Summarized, "count_prefix needs a summary policy");
+        return root ? top()->count_prefix(std::string_view(prefix)) : 0;
     }
-    ConstIterator& operator=(ConstIterator&& o)
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    typename Summary::type summarize_prefix(const T& prefix) const
     {
-        this->stk = std::move(o.stk);
-        return *this;
+        static_assert(NodeType::Summarized, "summarize_prefix needs a summary policy");
+        return root ? top()->summarize_prefix(std::string_view(prefix)) : Summary::identity();
     }
-
-    const value_type& operator*()
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    uint64_t rank(const T& key) const
     {
-        NodeType* node = nullptr;
-        node = this->stk.top();
-        return node->get_leaf().get_data();
+        static_assert(NodeType::Summarized, "rank needs a summary policy");
+        return root ? top()->rank(std::string_view(key)) : 0;
     }
-    const value_type* operator->()
+    ConstIteratorType select(uint64_t i) const
     {
-        return &(operator*());
+        static_assert(NodeType::Summarized, "select needs a summary policy");
+        if (!root || i >= NodeType::leaf_count(top())) {
+            return end();
+        }
+        return ConstIteratorType(top(), top()->select(i));
     }
-    ConstIterator& operator++()
+    template <typename T, typename OutputIt, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    OutputIt top_k(const T& prefix, std::size_t k, OutputIt out) const
     {
-        IteratorBaseType::next_leaf();
-        return *this;
+        static_assert(jzt::qp::is_max_score<Summary>::value, "top_k needs a MaxScore summary policy");
+        if (!root || k == 0) {
+            return out;
+        }
+        jzt::detail::qp::TwigIndexType first, last;
+        NodeType* node = top()->get_prefix(std::string_view(prefix), first, last);
+        if (node == nullptr) {
+            return out;
+        }
+        node->visit_best(first, last, k, [&](NodeType* leaf) { *out++ = ConstIteratorType(top(), leaf); });
+        return out;
     }
-    ConstIterator operator++(int)
+    template <typename Automaton, typename OutputIt>
+    OutputIt match(const Automaton& automaton, OutputIt out) const
     {
-        ConstIterator tmp(*this);
-        IteratorBaseType::next_leaf();
-        return tmp;
+        if (!root) {
+            return out;
+        }
+        jzt::detail::qp::AutomatonSearch<NodeType, Automaton> search(automaton);
+        search.run(top(), 0, [&](NodeType* leaf) { *out++ = ConstIteratorType(top(), leaf); });
+        return out;
+    }
+    template <typename T, typename OutputIt, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    OutputIt fuzzy_find(const T& query, unsigned max_distance, OutputIt out) const
+    {
+        if (!root) {
+            return out;
+        }
+        jzt::detail::qp::FuzzySearch<NodeType> search(std::string_view(query), max_distance);
+        search.run(top(), 0, [&](NodeType* leaf, unsigned distance) {
+            *out++ = std::make_pair(ConstIteratorType(top(), leaf), distance);
+        });
+        return out;
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains(const T& key) const
+    {
+        return root && top()->contains(std::string_view(key));
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool contains_prefix(const T& prefix) const
+    {
+        return root && top()->contains_prefix(std::string_view(prefix));
     }
 };
 
-template <typename DataType, bool IsMap>
+//Bits is the fan-out width: every branch tests one Bits wide nybble of the key and has up to
+//2^Bits twigs, wider nybbles make the trie shallower and its branches larger
+template <typename DataType, bool IsMap, unsigned Bits = 4, typename Summary = NoSummary, typename Counters = NoCounters>
 class Trie
 {
+    friend struct jzt::detail::qp::RootAccess;
 private:
     using LeafType = jzt::detail::qp::Leaf<DataType, IsMap>;
-    using NodeType = jzt::detail::qp::Node<DataType, IsMap>;
+    using NodeType = jzt::detail::qp::Node<DataType, IsMap, Bits, Summary, Counters>;
+    using BranchType = jzt::detail::qp::Branch<DataType, IsMap, Bits, Summary, Counters>;
     using key_type = typename LeafType::key_type;
     using value_type = typename LeafType::value_type;
     using mapped_type = typename LeafType::mapped_type;
@@ -859,61 +2996,258 @@ private:
 public:
     using IteratorType = Iterator<NodeType>;
     using ConstIteratorType = ConstIterator<NodeType>;
+    using ReverseIteratorType = std::reverse_iterator<IteratorType>;
+    using ConstReverseIteratorType = std::reverse_iterator<ConstIteratorType>;
+    using SnapshotType = Snapshot<DataType, IsMap, Bits, Summary, Counters>;
+    using SummaryValueType = typename Summary::type;
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
 
 private:
 
+    jzt::detail::qp::TwigPool<NodeType> pool;
     std::optional<NodeType> root;
 
-    static inline const IteratorType iterator_end = {};
+    void clear_root()
+    {
+        if (!root) {
+            return;
+        }
+        //leaves with trivial destructors are dropped together with the pool chunks
+        if constexpr (!std::is_trivially_destructible_v<DataType>) {
+            root->destroy(pool);
+        }
+        root.reset();
+    }
+    //the elements a mutable iterator reaches must not be shared with a snapshot, the first one
+    //taken after a snapshot copies every array the trie still shares, O(size)
+    void unshare()
+    {
+        if constexpr (!NodeType::ValueSummarized) {
+            auto* shared = pool.shared_twigs();
+            if (shared == nullptr || !shared->trie_shares) {
+                return;
+            }
+            pool.collect_shared();
+            if (root && root->is_branch() && shared->entries.load(std::memory_order_acquire) != 0) {
+                std::vector<NodeType*> work{&(root.value())};
+                while (!work.empty()) {
+                    auto& branch = work.back()->get_branch();
+                    work.pop_back();
+                    branch.make_unique(pool);
+                    for (jzt::detail::qp::TwigIndexType i = 0; i < branch.twig_count(); i++) {
+                        if (branch.twig(i)->is_branch()) {
+                            work.push_back(branch.twig(i));
+                        }
+                    }
+                }
+            }
+            shared->trie_shares = false;
+        }
+    }
 
 public:
     Trie() {}
+    //every twig array is allocated from alloc's memory resource, the root node is stored inline
+    explicit Trie(const allocator_type& alloc) : pool(alloc.resource()) {}
+    Trie(Trie&& o) : pool(std::move(o.pool)), root(std::move(o.root))
+    {
+        o.root.reset();
+    }
+    Trie(const Trie&) = delete;
+    Trie& operator= (const Trie&) = delete;
+    Trie& operator= (Trie&& o)
+    {
+        if (this != &o) {
+            clear_root();
+            pool = std::move(o.pool);
+            root = std::move(o.root);
+            o.root.reset();
+        }
+        return *this;
+    }
+    ~Trie()
+    {
+        clear_root();
+    }
 
+    allocator_type get_allocator() const
+    {
+        return allocator_type(pool.resource());
+    }
+    //walks every node, O(size)
+    TrieStats stats() const
+    {
+        TrieStats st;
+        st.fanouts.resize(NodeType::TwigMax + 1);
+        st.capacities.resize(NodeType::TwigMax + 1);
+        st.pool_bytes = pool.reserved_bytes();
+        st.free_bytes = pool.free_bytes();
+        if (!root) {
+            return st;
+        }
+        std::vector<std::pair<NodeType*, std::size_t>> work;
+        work.emplace_back(const_cast<NodeType*>(&(root.value())), 0);
+        while (!work.empty()) {
+            auto [node, depth] = work.back();
+            work.pop_back();
+            if (node->is_leaf()) {
+                auto& leaf = node->get_leaf();
+                st.leaves++;
+                if (st.leaf_depths.size() <= depth) {
+                    st.leaf_depths.resize(depth + 1);
+                }
+                st.leaf_depths[depth]++;
+                st.key_bytes += leaf.key_size();
+                st.heap_bytes += jzt::detail::qp::owned_bytes(leaf.get_key());
+                if constexpr (IsMap) {
+                    st.heap_bytes += jzt::detail::qp::owned_bytes(leaf.get_data().second);
+                }
+                continue;
+            }
+            auto& branch = node->get_branch();
+            jzt::detail::qp::TwigIndexType size = branch.twig_count();
+            jzt::detail::qp::TwigIndexType capacity = branch.twig_capacity();
+            st.branches++;
+            st.head_twigs += branch.has_head();
+            st.fanouts[size]++;
+            if (st.capacities[size].size() <= capacity) {
+                st.capacities[size].resize(capacity + 1);
+            }
+            st.capacities[size][capacity]++;
+            st.twig_bytes += capacity * sizeof(NodeType);
+            st.slack_bytes += (capacity - size) * sizeof(NodeType);
+            for (jzt::detail::qp::TwigIndexType i = 0; i < size; i++) {
+                work.emplace_back(branch.twig(i), depth + 1);
+            }
+        }
+        return st;
+    }
     static uint64_t max_key_size()
     {
-        return ((uint64_t)1 << 37);
+        return BranchType::IndexLimit / 8 * Bits;
     }
     IteratorType begin()
     {
+        unshare();
         if (!root) {
             return {};
         }
         return IteratorType(&(root.value()));
     }
-    ConstIteratorType cbegin()
+    ConstIteratorType begin() const
+    {
+        return cbegin();
+    }
+    ConstIteratorType cbegin() const
     {
         if (!root) {
             return {};
         }
-        return ConstIteratorType(&(root.value()));
+        return ConstIteratorType(const_cast<NodeType*>(&(root.value())));
     }
-    const IteratorType& end() const
+    //end iterators know the trie, so they can be decremented
+    IteratorType end()
     {
-        return iterator_end;
+        unshare();
+        return IteratorType(root ? &(root.value()) : nullptr, nullptr);
     }
-    const ConstIteratorType& cend() const
+    ConstIteratorType end() const
     {
-        return iterator_end;
+        return cend();
     }
+    ConstIteratorType cend() const
+    {
+        return ConstIteratorType(root ? const_cast<NodeType*>(&(root.value())) : nullptr, nullptr);
+    }
+    ReverseIteratorType rbegin()
+    {
+        return ReverseIteratorType(end());
+    }
+    ConstReverseIteratorType rbegin() const
+    {
+        return crbegin();
+    }
+    ReverseIteratorType rend()
+    {
+        return ReverseIteratorType(begin());
+    }
+    ConstReverseIteratorType rend() const
+    {
+        return crend();
+    }
+    ConstReverseIteratorType crbegin() const
+    {
+        return ConstReverseIteratorType(cend());
+    }
+    ConstReverseIteratorType crend() const
+    {
+        return ConstReverseIteratorType(cbegin());
+    }
+    //false when the key is already there, the element is left unchanged
     template <typename ...Args, std::enable_if_t<std::is_constructible_v<LeafType, Args...>, bool> = true>
-    void emplace(Args&&... args)
+    bool emplace(Args&&... args)
     {
         if (!root) {
             root.emplace(std::forward<Args>(args)...);
+            return true;
+        }
+        pool.collect_shared();
+        return root->emplace(pool, std::forward<Args>(args)...);
+    }
+    //O(1), the arrays of the trie become shared with the snapshot and are copied on the first write
+    //below them. the first mutable iterator taken afterwards copies every shared array, const
+    //iterators (cbegin, find on a const trie, ...) do not. mutable iterators taken before must not
+    //be written through while the snapshot is alive, the snapshot must be dropped before the trie
+    SnapshotType snapshot()
+    {
+        static_assert(std::is_copy_constructible_v<DataType>, "DataType must be copy constructible to take snapshots");
+        pool.collect_shared();
+        auto& shared = pool.make_shared_twigs();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.trie_shares = true;
+        return SnapshotType(&shared, root ? &(root.value()) : nullptr);
+    }
+    //[first, last) must be in ascending key order (byte-wise, as std::string compares), duplicates are skipped
+    //an empty trie is built bottom-up, every twig array is allocated once at its final size
+    template <typename InputIt>
+    void build_sorted(InputIt first, InputIt last)
+    {
+        if (root) {
+            for (; first != last; ++first) {
+                emplace(*first);
+            }
+            return;
+        }
+        jzt::detail::qp::SortedBuilder<DataType, IsMap, Bits, Summary, Counters> builder(pool);
+        for (; first != last; ++first) {
+            builder.push(*first);
+        }
+        builder.finish(root);
+    }
+    //same as build_sorted, the subtries under the top branches are built on up to threads threads
+    //elements must expose their key directly (sets) or as .first (maps)
+    template <typename RandomIt>
+    void build_sorted_parallel(RandomIt first, RandomIt last, unsigned threads = std::thread::hardware_concurrency())
+    {
+        std::size_t n = last - first;
+        if (root || threads <= 1 || n < 65536) {
+            build_sorted(first, last);
             return;
         }
-        root->emplace(std::forward<Args>(args)...);
+        jzt::detail::qp::ParallelBuilder<DataType, IsMap, Bits, Summary, Counters> builder(pool, std::max<std::size_t>(n / (threads * 8), 4096));
+        builder.build(first, last, threads, root);
     }
     template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
     IteratorType find(const T& key)
     {
+        unshare();
         if (!root) {
             return {};
         }
         std::string_view sv(key);
         NodeType* node = root->find(sv);
         if (node == nullptr) return {};
-        return IteratorType(node);
+        return IteratorType(&(root.value()), node);
     }
     template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
     ConstIteratorType find(const T& key) const
@@ -922,20 +3256,165 @@ public:
             return {};
         }
         std::string_view sv(key);
-        NodeType* node = root->find(sv);
+        NodeType* top = const_cast<NodeType*>(&(root.value()));
+        NodeType* node = top->find(sv);
         if (node == nullptr) return {};
-        return ConstIteratorType(node);
+        return ConstIteratorType(top, node);
     }
     template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
     IteratorType prefix(const T& prefix)
     {
+        unshare();
         if (!root) {
             return {};
         }
         std::string_view sv(prefix);
-        NodeType* node = root->get_prefix(sv);
+        jzt::detail::qp::TwigIndexType first, last;
+        NodeType* node = root->get_prefix(sv, first, last);
         if (node == nullptr) return {};
-        return IteratorType(node);
+        if (node->is_leaf()) return IteratorType(node);
+        return IteratorType(node, first, last);
+    }
+    //the first element whose key is not less than key, found in one walk down the trie
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    IteratorType lower_bound(const T& key)
+    {
+        unshare();
+        if (!root) {
+            return {};
+        }
+        IteratorType it(&(root.value()), nullptr);
+        root->seek(std::string_view(key), false, it);
+        return it;
+    }
+    //the first element whose key is greater than key
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    IteratorType upper_bound(const T& key)
+    {
+        unshare();
+        if (!root) {
+            return {};
+        }
+        IteratorType it(&(root.value()), nullptr);
+        root->seek(std::string_view(key), true, it);
+        return it;
+    }
+    //the element with the longest key that is a prefix of key (key itself included)
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    IteratorType longest_prefix_match(const T& key)
+    {
+        unshare();
+        if (!root) {
+            return {};
+        }
+        NodeType* found = nullptr;
+        root->visit_prefixes(std::string_view(key), [&](NodeType* node) { found = node; });
+        if (found == nullptr) return {};
+        return IteratorType(&(root.value()), found);
+    }
+    //f gets every element whose key is a prefix of key, shortest first. read only with a summary
+    //policy over the elements
+    template <typename T, typename F, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    void for_each_prefix_of(const T& key, F&& f)
+    {
+        unshare();
+        if (!root) {
+            return;
+        }
+        root->visit_prefixes(std::string_view(key), [&](NodeType* node) {
+            if constexpr (NodeType::ValueSummarized) {
+                f(std::as_const(node->get_leaf().get_data()));
+            } else {
+                f(node->get_leaf().get_data());
+            }
+        });
+    }
+    //the number of keys starting with prefix, in O(depth) from the leaf counts of the branches
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    uint64_t count_prefix(const T& prefix)
+    {
+        static_assert(NodeType::Summarized, "count_prefix needs a summary policy");
+        return root ? root->count_prefix(std::string_view(prefix)) : 0;
+    }
+    //the summary of the elements whose key starts with prefix
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    SummaryValueType summarize_prefix(const T& prefix)
+    {
+        static_assert(NodeType::Summarized, "summarize_prefix needs a summary policy");
+        return root ? root->summarize_prefix(std::string_view(prefix)) : Summary::identity();
+    }
+    //the number of keys less than key
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    uint64_t rank(const T& key)
+    {
+        static_assert(NodeType::Summarized, "rank needs a summary policy");
+        return root ? root->rank(std::string_view(key)) : 0;
+    }
+    //the element with i keys before it, end() when there are not that many
+    IteratorType select(uint64_t i)
+    {
+        static_assert(NodeType::Summarized, "select needs a summary policy");
+        unshare();
+        if (!root || i >= NodeType::leaf_count(&(root.value()))) {
+            return end();
+        }
+        return IteratorType(&(root.value()), root->select(i));
+    }
+    //writes iterators to the k elements with the highest scores among the keys starting with
+    //prefix, highest first, equal scores in no particular order. the summary policy must keep
+    //the maximum score of each subtree, see MaxScore
+    template <typename T, typename OutputIt, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    OutputIt top_k(const T& prefix, std::size_t k, OutputIt out)
+    {
+        static_assert(jzt::qp::is_max_score<Summary>::value, "top_k needs a MaxScore summary policy");
+        unshare();
+        if (!root || k == 0) {
+            return out;
+        }
+        jzt::detail::qp::TwigIndexType first, last;
+        NodeType* node = root->get_prefix(std::string_view(prefix), first, last);
+        if (node == nullptr) {
+            return out;
+        }
+        node->visit_best(first, last, k, [&](NodeType* leaf) { *out++ = IteratorType(&(root.value()), leaf); });
+        return out;
+    }
+    //writes iterators to the elements whose keys the automaton accepts, in key order, see Pattern.hpp
+    template <typename Automaton, typename OutputIt>
+    OutputIt match(const Automaton& automaton, OutputIt out)
+    {
+        unshare();
+        if (!root) {
+            return out;
+        }
+        jzt::detail::qp::AutomatonSearch<NodeType, Automaton> search(automaton);
+        search.run(&(root.value()), 0, [&](NodeType* leaf) { *out++ = IteratorType(&(root.value()), leaf); });
+        return out;
+    }
+    //writes (iterator, distance) pairs for the keys within max_distance edits of query, in key order
+    template <typename T, typename OutputIt, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    OutputIt fuzzy_find(const T& query, unsigned max_distance, OutputIt out)
+    {
+        unshare();
+        if (!root) {
+            return out;
+        }
+        jzt::detail::qp::FuzzySearch<NodeType> search(std::string_view(query), max_distance);
+        search.run(&(root.value()), 0, [&](NodeType* leaf, unsigned distance) {
+            *out++ = std::make_pair(IteratorType(&(root.value()), leaf), distance);
+        });
+        return out;
+    }
+    template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    std::pair<IteratorType, IteratorType> equal_range(const T& key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+    //the elements with keys in [from, to), from must not be greater than to
+    template <typename T, typename U, std::enable_if_t<std::is_convertible_v<T, std::string_view> && std::is_convertible_v<U, std::string_view>, bool> = true>
+    std::pair<IteratorType, IteratorType> range(const T& from, const U& to)
+    {
+        return {lower_bound(from), lower_bound(to)};
     }
 
     template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
@@ -946,6 +3425,36 @@ public:
         return root->contains(sv);
     }
 
+    //keys in [first, last) are looked up together, see Node::find_similar_batch
+    //one result per key is written to out in input order
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out)
+    {
+        if (!root) {
+            return std::fill_n(out, std::distance(first, last), false);
+        }
+        NodeType::find_similar_batch(&(root.value()), first, last, [&](std::string_view key, NodeType* node) {
+            *out++ = (node->get_leaf().key_equal(key));
+        });
+        return out;
+    }
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out)
+    {
+        unshare();
+        if (!root) {
+            return std::fill_n(out, std::distance(first, last), IteratorType());
+        }
+        NodeType::find_similar_batch(&(root.value()), first, last, [&](std::string_view key, NodeType* node) {
+            if (node->get_leaf().key_equal(key)) {
+                *out++ = IteratorType(&(root.value()), node);
+            } else {
+                *out++ = IteratorType();
+            }
+        });
+        return out;
+    }
+
     template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
     bool contains_prefix(const T& prefix)
     {
@@ -953,12 +3462,38 @@ public:
         std::string_view sv(prefix);
         return root->contains_prefix(sv);
     }
+    //calls f on the mapped value of key, the way to change a value under a summary policy over the
+    //elements, false when key is not there
+    template <typename T, typename F, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
+    bool update(const T& key, F&& f)
+    {
+        static_assert(IsMap, "update needs a map");
+        if (!root) return false;
+        std::string_view sv(key);
+        auto* shared = pool.shared_twigs();
+        if (shared != nullptr) {
+            pool.collect_shared();
+            //do not copy shared arrays for a key that is not there
+            if (shared->entries.load(std::memory_order_relaxed) != 0 && !root->contains(sv)) {
+                return false;
+            }
+        }
+        return root->update(pool, sv, f);
+    }
     template <typename T, std::enable_if_t<std::is_convertible_v<T, std::string_view>, bool> = true>
     bool remove(const T& key)
     {
         if (!root) return false;
         std::string_view sv(key);
-        auto ret = root->remove(sv);
+        auto* shared = pool.shared_twigs();
+        if (shared != nullptr) {
+            pool.collect_shared();
+            //do not copy shared arrays for a key that is not there
+            if (shared->entries.load(std::memory_order_relaxed) != 0 && !root->contains(sv)) {
+                return false;
+            }
+        }
+        auto ret = root->remove(pool, sv);
         if (!ret.first) return false;
         if (ret.second) {
             root.reset();
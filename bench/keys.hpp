@@ -0,0 +1,242 @@
+#ifndef BENCH_KEYS_HPP
+#define BENCH_KEYS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//synthetic key sets for qp_trie_bench, all deterministic for a given seed
+
+namespace bench {
+
+using Rng = std::mt19937_64;
+
+//pronounceable words built from syllables, drawn with a zipf-like skew so that a few words are
+//very common, as in real titles and paths
+class Vocabulary
+{
+    std::vector<std::string> words;
+    std::discrete_distribution<std::size_t> pick;
+
+public:
+    Vocabulary(Rng& rng, std::size_t size)
+    {
+        static const char* const onsets[] = {"b", "c", "d", "f", "g", "h", "k", "l", "m", "n", "p", "r", "s",
+            "t", "v", "w", "z", "ch", "sh", "th", "st", "tr", "br", "pl"};
+        static const char* const vowels[] = {"a", "e", "i", "o", "u", "y", "ai", "ea", "ou", "io"};
+        std::unordered_set<std::string> seen;
+        std::vector<double> weights;
+        while (words.size() < size) {
+            std::string w;
+            int syllables = 1 + rng() % 4;
+            for (int i = 0; i < syllables; i++) {
+                w += onsets[rng() % std::size(onsets)];
+                w += vowels[rng() % std::size(vowels)];
+            }
+            if (seen.insert(w).second) {
+                words.push_back(std::move(w));
+                weights.push_back(1.0 / words.size());
+            }
+        }
+        pick = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+    }
+    const std::string& operator()(Rng& rng)
+    {
+        return words[pick(rng)];
+    }
+};
+
+//https://www.<host>.<tld>/<seg>/<seg>[.html][?id=<n>], a few hosts hold most of the urls
+inline void url_key(Rng& rng, Vocabulary& hosts, Vocabulary& path, std::string& k)
+{
+    static const char* const tlds[] = {"com", "org", "net", "io", "de", "cn"};
+    k = rng() % 10 ? "https://" : "http://";
+    if (rng() % 4) {
+        k += "www.";
+    }
+    const std::string& host = hosts(rng);
+    k += host;
+    k += '.';
+    k += tlds[host.size() % std::size(tlds)];
+    int segments = 1 + rng() % 4;
+    for (int i = 0; i < segments; i++) {
+        k += '/';
+        k += path(rng);
+    }
+    if (rng() % 3 == 0) {
+        k += ".html";
+    }
+    if (rng() % 3 == 0) {
+        k += "?id=";
+        k += std::to_string(rng() % 100000);
+    }
+}
+
+//short wikipedia style titles, many share a handful of prefixes
+inline void title_key(Rng& rng, Vocabulary& words, std::string& k)
+{
+    auto word = [&]() {
+        std::size_t first = k.size();
+        k += words(rng);
+        k[first] = k[first] - 'a' + 'A';
+    };
+    k.clear();
+    unsigned kind = rng() % 20;
+    if (kind < 2) {
+        k += "List_of_";
+    } else if (kind < 3) {
+        k += std::to_string(1900 + rng() % 125);
+        k += "_in_";
+    } else if (kind < 4) {
+        k += "The_";
+    }
+    word();
+    int more = rng() % 3;
+    for (int i = 0; i < more; i++) {
+        k += '_';
+        word();
+    }
+    if (rng() % 20 == 0) {
+        k += "_(";
+        k += words(rng);
+        k += ')';
+    }
+}
+
+//4 to 32 uniformly random bytes, zero bytes included
+inline void binary_key(Rng& rng, std::string& k)
+{
+    k.resize(4 + rng() % 29);
+    for (char& c : k) {
+        c = static_cast<char>(rng());
+    }
+}
+
+//big endian 64 bit ids drawn from [0, range), so the byte order is the numeric order and the
+//high bytes are shared like in real id spaces
+inline void int_key(Rng& rng, uint64_t range, std::string& k)
+{
+    uint64_t v = rng() % range;
+    k.resize(8);
+    for (int i = 7; i >= 0; i--) {
+        k[i] = static_cast<char>(v & 0xff);
+        v >>= 8;
+    }
+}
+
+struct KeySet
+{
+    std::string name;
+    std::vector<std::string> present; //inserted, in random order
+    std::vector<std::string> absent; //never inserted, for negative lookups
+};
+
+//drops every key equal to an earlier one
+inline void drop_duplicates(std::vector<std::string>& keys)
+{
+    std::vector<uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    std::vector<char> duplicate(keys.size());
+    for (std::size_t i = 1; i < order.size(); i++) {
+        duplicate[order[i]] = keys[order[i]] == keys[order[i - 1]];
+    }
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        if (!duplicate[i]) {
+            if (kept != i) {
+                keys[kept] = std::move(keys[i]);
+            }
+            kept++;
+        }
+    }
+    keys.resize(kept);
+}
+
+//shuffles keys and splits them into present and absent halves
+inline KeySet split_keys(const std::string& name, std::vector<std::string>& keys, Rng& rng)
+{
+    std::shuffle(keys.begin(), keys.end(), rng);
+    auto half = keys.begin() + keys.size() / 2;
+    KeySet set{name, {}, {}};
+    set.present.assign(std::make_move_iterator(keys.begin()), std::make_move_iterator(half));
+    set.absent.assign(std::make_move_iterator(half), std::make_move_iterator(keys.end()));
+    return set;
+}
+
+//count present and count absent unique keys from gen. the keys are built in a reused buffer and
+//deduplicated without a hash set, so no freed blocks are left between them for a container to
+//reuse without its rss growing
+template <typename Gen>
+KeySet unique_keys(const std::string& name, std::size_t count, Rng& rng, Gen&& gen)
+{
+    std::vector<std::string> keys;
+    keys.reserve(count * 2);
+    std::string scratch;
+    for (int round = 0; keys.size() < count * 2; round++) {
+        if (round == 64) {
+            throw std::runtime_error("key generator " + name + " ran out of unique keys");
+        }
+        while (keys.size() < count * 2) {
+            gen(scratch);
+            keys.emplace_back(scratch);
+        }
+        drop_duplicates(keys);
+    }
+    return split_keys(name, keys, rng);
+}
+
+inline KeySet make_keys(const std::string& name, std::size_t count, uint64_t seed)
+{
+    Rng rng(seed);
+    if (name == "url") {
+        Vocabulary hosts(rng, 2000);
+        Vocabulary path(rng, 20000);
+        return unique_keys(name, count, rng, [&](std::string& k) { url_key(rng, hosts, path, k); });
+    }
+    if (name == "title") {
+        Vocabulary words(rng, 50000);
+        return unique_keys(name, count, rng, [&](std::string& k) { title_key(rng, words, k); });
+    }
+    if (name == "binary") {
+        return unique_keys(name, count, rng, [&](std::string& k) { binary_key(rng, k); });
+    }
+    if (name == "int") {
+        uint64_t range = count * 16;
+        return unique_keys(name, count, rng, [&](std::string& k) { int_key(rng, range, k); });
+    }
+    throw std::invalid_argument("unknown key set " + name);
+}
+
+//one key per line, duplicates dropped, e.g. a shuffled title dump
+inline KeySet load_keys(const std::string& path, std::size_t count, uint64_t seed)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    Rng rng(seed);
+    std::vector<std::string> keys;
+    std::string line;
+    while (keys.size() < count * 2 && std::getline(in, line)) {
+        if (!line.empty()) {
+            keys.push_back(line);
+        }
+    }
+    drop_duplicates(keys);
+    if (keys.size() < 2) {
+        throw std::runtime_error(path + " has fewer than two distinct keys");
+    }
+    return split_keys("file", keys, rng);
+}
+
+} //namespace bench
+
+#endif // BENCH_KEYS_HPP
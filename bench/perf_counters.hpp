@@ -0,0 +1,155 @@
+#ifndef BENCH_PERF_COUNTERS_HPP
+#define BENCH_PERF_COUNTERS_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//hardware counters of the calling process through perf_event_open, user space only so that the
+//default perf_event_paranoid of 2 allows them. an event the cpu, the kernel or a container does not
+//provide is left out and reads as empty, with none left the bench reports timing only
+
+namespace bench {
+
+enum class Event
+{
+    Cycles,
+    Instructions,
+    L1dMisses,
+    LlcMisses,
+    DtlbMisses,
+    BranchMisses,
+    Count
+};
+
+inline const char* event_name(Event e)
+{
+    static const char* const names[] = {"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses",
+        "branch_misses"};
+    return names[static_cast<int>(e)];
+}
+
+//totals of one measured region, scaled up when the kernel had to multiplex the counters
+struct EventCounts
+{
+    std::array<std::optional<double>, static_cast<int>(Event::Count)> values;
+
+    std::optional<double> operator[](Event e) const
+    {
+        return values[static_cast<int>(e)];
+    }
+};
+
+class PerfCounters
+{
+    static constexpr int N = static_cast<int>(Event::Count);
+    std::array<int, N> fds;
+
+#if defined(__linux__)
+    static int open_event(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    static constexpr uint64_t cache_miss(uint64_t cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+public:
+    explicit PerfCounters(bool enabled)
+    {
+        fds.fill(-1);
+#if defined(__linux__)
+        if (!enabled) {
+            return;
+        }
+        fds[static_cast<int>(Event::Cycles)] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[static_cast<int>(Event::Instructions)] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[static_cast<int>(Event::L1dMisses)] = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+        //not every cpu has the last level cache event, the generic cache miss event counts the same there
+        int llc = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+        if (llc < 0) {
+            llc = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        }
+        fds[static_cast<int>(Event::LlcMisses)] = llc;
+        fds[static_cast<int>(Event::DtlbMisses)] = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+        fds[static_cast<int>(Event::BranchMisses)] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#else
+        (void)enabled;
+#endif
+    }
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator= (const PerfCounters&) = delete;
+
+    bool available() const
+    {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    void start()
+    {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+    EventCounts stop()
+    {
+        EventCounts counts;
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int i = 0; i < N; i++) {
+            uint64_t data[3]; //value, time enabled, time running
+            if (fds[i] < 0 || read(fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+                continue;
+            }
+            counts.values[i] = static_cast<double>(data[0]) * data[1] / data[2];
+        }
+#endif
+        return counts;
+    }
+};
+
+} //namespace bench
+
+#endif // BENCH_PERF_COUNTERS_HPP
@@ -0,0 +1,761 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "Trie.hpp"
+#include "keys.hpp"
+#include "perf_counters.hpp"
+
+//qp_trie_bench runs the same operations over the same keys against the qp-trie and the standard
+//containers, and reports throughput, latency percentiles and memory per workload:
+//  insert_random  insert every key in random order into an empty container
+//  insert_sorted  insert every key in key order into an empty container
+//  find_hit       look up every inserted key in random order
+//  find_miss      look up as many keys that were never inserted
+//  prefix_scan    visit every element below a prefix of an inserted key, sized for 1 to 1000 hits
+//  erase          erase every key in random order
+//  mixed          lookups, inserts and erases interleaved over a half full container
+//latencies are taken for one op in every --sample ops, the clock reads stay out of the others.
+//memory is the heap in use after insert_random and at the peak, counted through operator new,
+//and the peak rss of the child process the container runs in. where perf_event_open works, every
+//workload also gets cycles, instructions, l1d, llc and dtlb misses and branch misses per op, the
+//sampled clock reads included
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::size_t n = 1000000;
+    uint64_t seed = 1;
+    std::vector<std::string> keys = {"url", "title", "binary", "int"};
+    std::vector<std::string> containers = {"qp_set", "std_set", "qp_map", "std_map", "std_unordered_map"};
+    std::vector<std::string> workloads = {"insert_random", "insert_sorted", "find_hit", "find_miss",
+        "prefix_scan", "erase", "mixed"};
+    std::string file;
+    double read_ratio = 0.9;
+    unsigned sample = 8;
+    bool csv = false;
+    bool perf = true;
+
+    bool runs(const std::string& workload) const
+    {
+        return std::find(workloads.begin(), workloads.end(), workload) != workloads.end();
+    }
+};
+
+//the workload inputs shared by every container of one key set
+struct Workload
+{
+    const KeySet& keys;
+    std::vector<std::string> sorted;
+    std::vector<std::string> prefixes;
+    struct Op
+    {
+        enum Kind : uint8_t {Find, Insert, Erase} kind;
+        const std::string* key;
+    };
+    std::size_t mixed_base; //keys.present[0, mixed_base) are inserted before the mixed ops
+    std::vector<Op> mixed;
+
+    std::size_t count_prefix(std::string_view prefix) const
+    {
+        auto first = std::lower_bound(sorted.begin(), sorted.end(), prefix);
+        auto last = std::partition_point(first, sorted.end(), [&](const std::string& k) {
+            return k.compare(0, prefix.size(), prefix) == 0;
+        });
+        return last - first;
+    }
+    //the shortest prefix of key with at most target keys below it, so that the scan sizes are
+    //spread the same way whatever the shape of the key set
+    std::string scan_prefix(std::string_view key, double target) const
+    {
+        std::size_t lo = 1, hi = key.size();
+        while (lo < hi) {
+            std::size_t mid = lo + (hi - lo) / 2;
+            if (count_prefix(key.substr(0, mid)) <= target) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        return std::string(key.substr(0, lo));
+    }
+
+    Workload(const KeySet& k, const Options& opt) : keys(k), sorted(k.present)
+    {
+        std::sort(sorted.begin(), sorted.end());
+        Rng rng(opt.seed + 1);
+        std::size_t n = keys.present.size();
+        std::size_t queries = std::max<std::size_t>(1, std::min<std::size_t>(n / 10, 10000));
+        std::uniform_real_distribution<double> exponent(0, 3);
+        for (std::size_t i = 0; i < queries; i++) {
+            const std::string& key = keys.present[rng() % n];
+            prefixes.push_back(scan_prefix(key, std::pow(10, exponent(rng))));
+        }
+        mixed_base = n / 2;
+        std::size_t pending = mixed_base;
+        std::uniform_real_distribution<double> coin;
+        for (std::size_t i = 0; i < n; i++) {
+            if (coin(rng) < opt.read_ratio) {
+                mixed.push_back({Op::Find, &keys.present[rng() % n]});
+            } else if (rng() % 2) {
+                mixed.push_back({Op::Insert, &keys.present[pending]});
+                pending = pending + 1 < n ? pending + 1 : mixed_base;
+            } else {
+                mixed.push_back({Op::Erase, &keys.present[rng() % n]});
+            }
+        }
+    }
+};
+
+//one uniform interface per container, find and erase report whether the key was there
+struct QpSet
+{
+    jzt::qp::Trie<std::string, false> c;
+
+    bool insert(const std::string& k)
+    {
+        return c.emplace(k);
+    }
+    bool find(const std::string& k)
+    {
+        return c.contains(k);
+    }
+    bool erase(const std::string& k)
+    {
+        return c.remove(k);
+    }
+    std::size_t scan(const std::string& prefix)
+    {
+        std::size_t n = 0;
+        for (auto it = c.prefix(prefix); it != c.end(); ++it) {
+            n++;
+        }
+        return n;
+    }
+};
+
+struct QpMap
+{
+    jzt::qp::Trie<std::pair<std::string, uint64_t>, true> c;
+
+    bool insert(const std::string& k)
+    {
+        return c.emplace(k, k.size());
+    }
+    bool find(const std::string& k)
+    {
+        return c.find(k) != c.end();
+    }
+    bool erase(const std::string& k)
+    {
+        return c.remove(k);
+    }
+    std::size_t scan(const std::string& prefix)
+    {
+        std::size_t n = 0;
+        for (auto it = c.prefix(prefix); it != c.end(); ++it) {
+            n += it->second != 0;
+        }
+        return n;
+    }
+};
+
+//std::set and std::map, scanned from lower_bound while the prefix matches
+template <typename C>
+struct StdOrdered
+{
+    C c;
+
+    static const std::string& key_of(const std::string& k)
+    {
+        return k;
+    }
+    template <typename V>
+    static const std::string& key_of(const std::pair<const std::string, V>& kv)
+    {
+        return kv.first;
+    }
+
+    bool insert(const std::string& k)
+    {
+        if constexpr (std::is_same_v<typename C::key_type, typename C::value_type>) {
+            return c.emplace(k).second;
+        } else {
+            return c.emplace(k, k.size()).second;
+        }
+    }
+    bool find(const std::string& k)
+    {
+        return c.find(k) != c.end();
+    }
+    bool erase(const std::string& k)
+    {
+        return c.erase(k) != 0;
+    }
+    std::size_t scan(const std::string& prefix)
+    {
+        std::size_t n = 0;
+        for (auto it = c.lower_bound(prefix); it != c.end(); ++it) {
+            if (key_of(*it).compare(0, prefix.size(), prefix) != 0) {
+                break;
+            }
+            n++;
+        }
+        return n;
+    }
+};
+
+struct StdUnordered
+{
+    std::unordered_map<std::string, uint64_t> c;
+
+    bool insert(const std::string& k)
+    {
+        return c.emplace(k, k.size()).second;
+    }
+    bool find(const std::string& k)
+    {
+        return c.find(k) != c.end();
+    }
+    bool erase(const std::string& k)
+    {
+        return c.erase(k) != 0;
+    }
+};
+
+template <typename T, typename = void>
+struct has_scan : std::false_type {};
+template <typename T>
+struct has_scan<T, std::void_t<decltype(std::declval<T&>().scan(std::string()))>> : std::true_type {};
+
+//live and peak bytes requested through operator new, exact whatever the allocator keeps cached
+struct Heap
+{
+    static inline std::size_t live = 0;
+    static inline std::size_t peak = 0;
+
+    static void reset_peak()
+    {
+        peak = live;
+    }
+};
+
+//resident set size of the process in KiB, the peak can be restarted on linux
+struct Rss
+{
+    static long status(const char* field)
+    {
+        std::ifstream in("/proc/self/status");
+        std::string line;
+        std::size_t len = std::strlen(field);
+        while (std::getline(in, line)) {
+            if (line.compare(0, len, field) == 0) {
+                return std::atol(line.c_str() + len);
+            }
+        }
+        return -1;
+    }
+    static long peak_kib()
+    {
+        long peak = status("VmHWM:");
+        if (peak < 0) {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            peak = usage.ru_maxrss;
+        }
+        return peak;
+    }
+    //hands freed heap back to the kernel and restarts VmHWM at the current rss
+    static long reset_peak()
+    {
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+        {
+            std::ofstream out("/proc/self/clear_refs");
+            out << "5";
+        }
+        return status("VmRSS:");
+    }
+};
+
+struct Memory
+{
+    std::size_t heap = 0; //after insert_random
+    std::size_t heap_peak = 0;
+    long rss_peak_kib = 0; //above the rss before the container was created
+};
+
+struct Result
+{
+    std::string workload;
+    std::size_t ops = 0;
+    double seconds = 0;
+    std::size_t hits = 0; //keys found, inserted or erased, elements scanned
+    std::vector<uint64_t> samples; //nanoseconds
+    EventCounts events;
+
+    uint64_t percentile(double q) const
+    {
+        if (samples.empty()) {
+            return 0;
+        }
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))];
+    }
+};
+
+template <typename F>
+Result measure(const std::string& workload, std::size_t ops, const Options& opt, PerfCounters& perf, F&& op)
+{
+    Result r;
+    r.workload = workload;
+    r.ops = ops;
+    if (opt.sample) {
+        r.samples.reserve(ops / opt.sample + 1);
+    }
+    perf.start();
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < ops; i++) {
+        if (opt.sample && i % opt.sample == 0) {
+            auto t0 = Clock::now();
+            r.hits += op(i);
+            auto t1 = Clock::now();
+            r.samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+        } else {
+            r.hits += op(i);
+        }
+    }
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    r.events = perf.stop();
+    std::sort(r.samples.begin(), r.samples.end());
+    return r;
+}
+
+class Report
+{
+    const Options& opt;
+
+    static std::optional<double> per_op(std::optional<double> total, std::size_t ops)
+    {
+        if (!total || ops == 0) {
+            return {};
+        }
+        return *total / ops;
+    }
+    static std::optional<double> ipc(const EventCounts& events)
+    {
+        auto cycles = events[Event::Cycles];
+        auto instructions = events[Event::Instructions];
+        if (!cycles || !instructions || *cycles <= 0) {
+            return {};
+        }
+        return *instructions / *cycles;
+    }
+    //a missing event is a - in the table and an empty csv field
+    void field(const char* format, int width, std::optional<double> value) const
+    {
+        if (value) {
+            std::printf(format, *value);
+        } else if (opt.csv) {
+            std::printf(",");
+        } else {
+            std::printf(" %*s", width, "-");
+        }
+    }
+
+public:
+    explicit Report(const Options& o) : opt(o)
+    {
+        if (opt.csv) {
+            std::cout << "keys,container,workload,ops,seconds,mops,ns_per_op,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,hits,"
+                         "heap_bytes,heap_peak_bytes,rss_peak_kib";
+            for (int e = 0; e < static_cast<int>(Event::Count); e++) {
+                std::cout << ',' << event_name(static_cast<Event>(e)) << "_per_op";
+            }
+            std::cout << ",ipc\n";
+        }
+    }
+    void keys(const KeySet& keys)
+    {
+        if (opt.csv) {
+            return;
+        }
+        std::size_t bytes = 0;
+        for (const std::string& k : keys.present) {
+            bytes += k.size();
+        }
+        std::printf("\nkeys=%s n=%zu avg_len=%.1f\n", keys.name.c_str(), keys.present.size(),
+            keys.present.empty() ? 0.0 : static_cast<double>(bytes) / keys.present.size());
+        std::printf("%-18s %-14s %9s %8s %8s %7s %7s %7s %8s %9s %10s", "container", "workload", "ops", "Mops/s",
+            "ns/op", "p50", "p90", "p99", "p99.9", "max", "hits");
+        if (opt.perf) {
+            std::printf(" %8s %8s %5s %7s %7s %7s %7s", "cyc/op", "ins/op", "ipc", "l1d/op", "llc/op", "dtlb/op",
+                "br/op");
+        }
+        std::printf("\n");
+    }
+    void container(const KeySet& keys, const std::string& name, const std::vector<Result>& results,
+        const Memory& mem)
+    {
+        for (const Result& r : results) {
+            double mops = r.seconds > 0 ? r.ops / r.seconds / 1e6 : 0;
+            double ns = r.ops ? r.seconds * 1e9 / r.ops : 0;
+            uint64_t max = r.samples.empty() ? 0 : r.samples.back();
+            if (opt.csv) {
+                std::printf("%s,%s,%s,%zu,%.6f,%.4f,%.1f,%llu,%llu,%llu,%llu,%llu,%zu,%zu,%zu,%ld", keys.name.c_str(),
+                    name.c_str(), r.workload.c_str(), r.ops, r.seconds, mops, ns,
+                    (unsigned long long)r.percentile(0.5), (unsigned long long)r.percentile(0.9),
+                    (unsigned long long)r.percentile(0.99), (unsigned long long)r.percentile(0.999),
+                    (unsigned long long)max, r.hits, mem.heap, mem.heap_peak, mem.rss_peak_kib);
+                for (int e = 0; e < static_cast<int>(Event::Count); e++) {
+                    field(",%.3f", 0, per_op(r.events[static_cast<Event>(e)], r.ops));
+                }
+                field(",%.3f", 0, ipc(r.events));
+                std::printf("\n");
+            } else {
+                std::printf("%-18s %-14s %9zu %8.3f %8.1f %7llu %7llu %7llu %8llu %9llu %10zu", name.c_str(),
+                    r.workload.c_str(), r.ops, mops, ns, (unsigned long long)r.percentile(0.5),
+                    (unsigned long long)r.percentile(0.9), (unsigned long long)r.percentile(0.99),
+                    (unsigned long long)r.percentile(0.999), (unsigned long long)max, r.hits);
+                if (opt.perf) {
+                    field(" %8.1f", 8, per_op(r.events[Event::Cycles], r.ops));
+                    field(" %8.1f", 8, per_op(r.events[Event::Instructions], r.ops));
+                    field(" %5.2f", 5, ipc(r.events));
+                    field(" %7.2f", 7, per_op(r.events[Event::L1dMisses], r.ops));
+                    field(" %7.2f", 7, per_op(r.events[Event::LlcMisses], r.ops));
+                    field(" %7.2f", 7, per_op(r.events[Event::DtlbMisses], r.ops));
+                    field(" %7.2f", 7, per_op(r.events[Event::BranchMisses], r.ops));
+                }
+                std::printf("\n");
+            }
+        }
+        if (!opt.csv) {
+            std::printf("%-18s memory: heap %.1f MiB after insert (%.1f B/key), heap peak %.1f MiB, rss peak %.1f MiB\n",
+                name.c_str(), mem.heap / 1048576.0, keys.present.empty() ? 0.0 : double(mem.heap) / keys.present.size(),
+                mem.heap_peak / 1048576.0, mem.rss_peak_kib / 1024.0);
+        }
+        std::fflush(stdout);
+    }
+};
+
+//the memory figures are relative to the heap and the rss before the container was created
+template <typename Adapter>
+void run_container(const std::string& name, const Workload& w, const Options& opt, Report& report)
+{
+    const std::vector<std::string>& present = w.keys.present;
+    const std::vector<std::string>& absent = w.keys.absent;
+    std::vector<Result> results;
+    Memory mem;
+    PerfCounters perf(opt.perf);
+    long rss_base = Rss::reset_peak();
+    std::size_t heap_base = Heap::live;
+    Heap::reset_peak();
+    {
+        Adapter a;
+        auto insert = [&](std::size_t i) { return a.insert(present[i]); };
+        if (opt.runs("insert_random")) {
+            results.push_back(measure("insert_random", present.size(), opt, perf, insert));
+        } else {
+            for (std::size_t i = 0; i < present.size(); i++) {
+                insert(i);
+            }
+        }
+        mem.heap = Heap::live - heap_base;
+        if (opt.runs("find_hit")) {
+            results.push_back(measure("find_hit", present.size(), opt, perf, [&](std::size_t i) {
+                return a.find(present[i]);
+            }));
+        }
+        if (opt.runs("find_miss")) {
+            results.push_back(measure("find_miss", absent.size(), opt, perf, [&](std::size_t i) {
+                return a.find(absent[i]);
+            }));
+        }
+        if constexpr (has_scan<Adapter>::value) {
+            if (opt.runs("prefix_scan")) {
+                results.push_back(measure("prefix_scan", w.prefixes.size(), opt, perf, [&](std::size_t i) {
+                    return a.scan(w.prefixes[i]);
+                }));
+            }
+        }
+        if (opt.runs("erase")) {
+            results.push_back(measure("erase", present.size(), opt, perf, [&](std::size_t i) {
+                return a.erase(present[i]);
+            }));
+        }
+    }
+    if (opt.runs("insert_sorted")) {
+        Adapter a;
+        results.push_back(measure("insert_sorted", w.sorted.size(), opt, perf, [&](std::size_t i) {
+            return a.insert(w.sorted[i]);
+        }));
+    }
+    if (opt.runs("mixed")) {
+        Adapter a;
+        for (std::size_t i = 0; i < w.mixed_base; i++) {
+            a.insert(present[i]);
+        }
+        results.push_back(measure("mixed", w.mixed.size(), opt, perf, [&](std::size_t i) {
+            const Workload::Op& op = w.mixed[i];
+            switch (op.kind) {
+            case Workload::Op::Insert:
+                return a.insert(*op.key);
+            case Workload::Op::Erase:
+                return a.erase(*op.key);
+            default:
+                return a.find(*op.key);
+            }
+        }));
+    }
+    mem.heap_peak = Heap::peak - heap_base;
+    mem.rss_peak_kib = Rss::peak_kib() - rss_base;
+    report.container(w.keys, name, results, mem);
+}
+
+void run_container(const std::string& name, const Workload& w, const Options& opt, Report& report)
+{
+    if (name == "qp_set") {
+        run_container<QpSet>(name, w, opt, report);
+    } else if (name == "qp_map") {
+        run_container<QpMap>(name, w, opt, report);
+    } else if (name == "std_set") {
+        run_container<StdOrdered<std::set<std::string, std::less<>>>>(name, w, opt, report);
+    } else if (name == "std_map") {
+        run_container<StdOrdered<std::map<std::string, uint64_t, std::less<>>>>(name, w, opt, report);
+    } else if (name == "std_unordered_map") {
+        run_container<StdUnordered>(name, w, opt, report);
+    } else {
+        throw std::invalid_argument("unknown container " + name);
+    }
+}
+
+//every container runs in its own child process, so none of them finds the heap of an earlier
+//one already resident and the rss peaks stay comparable
+void run_keys(const KeySet& keys, const Options& opt, Report& report)
+{
+    Workload w(keys, opt);
+    report.keys(keys);
+    for (const std::string& name : opt.containers) {
+        std::fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            run_container(name, w, opt, report);
+            continue;
+        }
+        if (pid == 0) {
+            int status = 0;
+            try {
+                run_container(name, w, opt, report);
+            } catch (const std::exception& e) {
+                std::fprintf(stderr, "qp_trie_bench: %s\n", e.what());
+                status = 1;
+            }
+            std::fflush(stdout);
+            std::_Exit(status);
+        }
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw std::runtime_error(name + " on " + keys.name + " keys failed");
+        }
+    }
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+void usage(const char* argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --n N              keys per key set (1000000)\n"
+        "  --keys LIST        url,title,binary,int\n"
+        "  --file PATH        also run on the distinct lines of PATH, e.g. a shuffled title dump\n"
+        "  --containers LIST  qp_set,std_set,qp_map,std_map,std_unordered_map\n"
+        "  --workloads LIST   insert_random,insert_sorted,find_hit,find_miss,prefix_scan,erase,mixed\n"
+        "  --read-ratio R     share of lookups in mixed (0.9)\n"
+        "  --sample K         time one op in every K for the percentiles, 0 for none (8)\n"
+        "  --seed S           seed of the key generators (1)\n"
+        "  --csv              one csv row per container and workload\n"
+        "  --no-perf          leave the hardware counters out\n",
+        argv0);
+}
+
+} //namespace bench
+
+//counts what malloc hands out for Heap, allocator rounding included but not its headers
+#if defined(__GLIBC__)
+namespace {
+void* counted(void* p)
+{
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    bench::Heap::live += malloc_usable_size(p);
+    bench::Heap::peak = std::max(bench::Heap::peak, bench::Heap::live);
+    return p;
+}
+void uncounted(void* p)
+{
+    if (p != nullptr) {
+        bench::Heap::live -= malloc_usable_size(p);
+        std::free(p);
+    }
+}
+} //namespace
+
+void* operator new(std::size_t size)
+{
+    return counted(std::malloc(size ? size : 1));
+}
+void* operator new[](std::size_t size)
+{
+    return counted(std::malloc(size ? size : 1));
+}
+//the pmr resources behind the trie's twig pool allocate with an explicit alignment
+void* operator new(std::size_t size, std::align_val_t al)
+{
+    std::size_t align = static_cast<std::size_t>(al);
+    return counted(std::aligned_alloc(align, (size + align - 1) / align * align));
+}
+void* operator new[](std::size_t size, std::align_val_t al)
+{
+    return operator new(size, al);
+}
+void operator delete(void* p) noexcept
+{
+    uncounted(p);
+}
+void operator delete[](void* p) noexcept
+{
+    uncounted(p);
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+    uncounted(p);
+}
+void operator delete[](void* p, std::size_t) noexcept
+{
+    uncounted(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    uncounted(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    uncounted(p);
+}
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    uncounted(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    uncounted(p);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    using namespace bench;
+    Options opt;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument(arg + " needs a value");
+                }
+                return argv[++i];
+            };
+            if (arg == "--n") {
+                opt.n = std::stoull(value());
+            } else if (arg == "--keys") {
+                opt.keys = split(value());
+            } else if (arg == "--file") {
+                opt.file = value();
+            } else if (arg == "--containers") {
+                opt.containers = split(value());
+            } else if (arg == "--workloads") {
+                opt.workloads = split(value());
+            } else if (arg == "--read-ratio") {
+                opt.read_ratio = std::stod(value());
+            } else if (arg == "--sample") {
+                opt.sample = std::stoul(value());
+            } else if (arg == "--seed") {
+                opt.seed = std::stoull(value());
+            } else if (arg == "--csv") {
+                opt.csv = true;
+            } else if (arg == "--no-perf") {
+                opt.perf = false;
+            } else if (arg == "--help" || arg == "-h") {
+                usage(argv[0]);
+                return 0;
+            } else {
+                throw std::invalid_argument("unknown option " + arg);
+            }
+        }
+        if (opt.n == 0) {
+            throw std::invalid_argument("--n must be positive");
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        usage(argv[0]);
+        return 2;
+    }
+    if (opt.perf && !PerfCounters(true).available()) {
+        std::fprintf(stderr, "qp_trie_bench: no hardware counters from perf_event_open, timing only\n");
+        opt.perf = false;
+    }
+    try {
+        Report report(opt);
+        for (const std::string& name : opt.keys) {
+            run_keys(make_keys(name, opt.n, opt.seed), opt, report);
+        }
+        if (!opt.file.empty()) {
+            run_keys(load_keys(opt.file, opt.n, opt.seed), opt, report);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "qp_trie_bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef TESTS_CHECK_HPP
+#define TESTS_CHECK_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <string>
+
+//a failed CHECK is reported and counted, the test goes on so one run shows every failure. CHECK
+//may be used from several threads
+
+namespace test {
+
+inline std::atomic<int> failures(0);
+
+inline void check(bool ok, const char* what, const char* file, int line)
+{
+    if (!ok) {
+        if (failures++ < 20) {
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+        }
+    }
+}
+
+//the exit code of a test
+inline int finish(const char* name)
+{
+    if (failures > 0) {
+        std::fprintf(stderr, "%s: %d checks failed\n", name, failures.load());
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
+
+//up to max_size bytes from the first alphabet_size bytes of a small alphabet, so keys share
+//prefixes, contain zero bytes and bytes above 0x7f, and hit every branch and head twig case
+inline std::string random_key(std::mt19937_64& rng, int max_size, int alphabet_size)
+{
+    static const char alphabet[] = {'a', 'b', '\0', '\xf0', '\x11', 'z', 'Z', '\x10'};
+    std::string key(rng() % (max_size + 1), '\0');
+    for (char& c : key) {
+        c = alphabet[rng() % alphabet_size];
+    }
+    return key;
+}
+
+} //namespace test
+
+#define CHECK(cond) test::check(static_cast<bool>(cond), #cond, __FILE__, __LINE__)
+
+#endif // TESTS_CHECK_HPP
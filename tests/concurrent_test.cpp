@@ -0,0 +1,152 @@
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConcurrentTrie.hpp"
+#include "tests/check.hpp"
+
+//readers racing writers, meant to be run under -fsanitize=thread as well. the readers check what
+//must hold at every moment: the keys that are never removed are found with their values, and
+//every view is sorted and holds only values that belong to their keys
+
+using Element = std::pair<std::string, uint64_t>;
+
+static uint64_t value_of(std::string_view key)
+{
+    return std::hash<std::string_view>{}(key);
+}
+
+static std::string stable_key(int i)
+{
+    return "stable/" + std::to_string(i * 7919 % 1000);
+}
+
+static std::string churn_key(std::mt19937_64& rng)
+{
+    return "churn/" + std::to_string(rng() % 2000);
+}
+
+static void check_concurrent_trie()
+{
+    jzt::qp::ConcurrentTrie<Element, true> t;
+    for (int i = 0; i < 1000; i++) {
+        std::string key = stable_key(i);
+        t.emplace(key, value_of(key));
+    }
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; r++) {
+        readers.emplace_back([&, r]() {
+            std::mt19937_64 rng(r);
+            while (!done.load(std::memory_order_acquire)) {
+                auto view = t.read();
+                for (int i = 0; i < 20; i++) {
+                    std::string key = stable_key(rng() % 1000);
+                    auto it = view.find(key);
+                    CHECK(it != view.end() && it->second == value_of(key));
+                }
+                std::string last;
+                std::size_t churned = 0;
+                for (auto it = view.prefix("churn/"); it != view.end(); ++it) {
+                    CHECK(last < it->first && it->second == value_of(it->first));
+                    last = it->first;
+                    churned++;
+                }
+                CHECK(churned <= 2000);
+                CHECK(view.contains_prefix("stable/"));
+            }
+        });
+    }
+    std::map<std::string, uint64_t> ref;
+    std::mt19937_64 rng(99);
+    for (int i = 0; i < 50000; i++) {
+        std::string key = churn_key(rng);
+        if (rng() % 2) {
+            CHECK(t.emplace(key, value_of(key)) == ref.emplace(key, value_of(key)).second);
+        } else {
+            CHECK(t.remove(key) == (ref.erase(key) == 1));
+        }
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    auto view = t.read();
+    std::map<std::string, uint64_t> churned;
+    for (auto it = view.prefix("churn/"); it != view.end(); ++it) {
+        churned.emplace(it->first, it->second);
+    }
+    CHECK(churned == ref);
+}
+
+//writers on their own keys, spread over every top-level twig and sharing some, readers on the keys
+//that are never removed
+static void check_striped_trie()
+{
+    jzt::qp::StripedTrie<Element, true> t;
+    for (int i = 0; i < 1000; i++) {
+        std::string key = stable_key(i);
+        t.emplace(key, value_of(key));
+    }
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&, r]() {
+            std::mt19937_64 rng(r);
+            while (!done.load(std::memory_order_acquire)) {
+                std::string key = stable_key(rng() % 1000);
+                uint64_t seen = 0;
+                CHECK(t.visit(key, [&](const Element& e) { seen = e.second; }));
+                CHECK(seen == value_of(key));
+                CHECK(t.contains_prefix("stable/"));
+            }
+        });
+    }
+    const int writer_count = 4;
+    std::vector<std::map<std::string, uint64_t>> refs(writer_count);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writer_count; w++) {
+        writers.emplace_back([&, w]() {
+            std::mt19937_64 rng(100 + w);
+            for (int i = 0; i < 20000; i++) {
+                //the first byte picks the top-level twig, writer w owns the keys ending in w
+                std::string key(1, static_cast<char>(rng() % 256));
+                key += std::to_string(rng() % 500) + "/" + std::to_string(w);
+                if (rng() % 2) {
+                    CHECK(t.emplace(key, value_of(key)) == refs[w].emplace(key, value_of(key)).second);
+                } else {
+                    CHECK(t.remove(key) == (refs[w].erase(key) == 1));
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    std::map<std::string, uint64_t> want;
+    for (auto& ref : refs) {
+        want.insert(ref.begin(), ref.end());
+    }
+    for (int i = 0; i < 1000; i++) {
+        std::string key = stable_key(i);
+        want.emplace(key, value_of(key));
+    }
+    std::map<std::string, uint64_t> got;
+    t.for_each([&](const Element& e) { got.emplace(e.first, e.second); });
+    CHECK(got == want);
+}
+
+int main()
+{
+    check_concurrent_trie();
+    check_striped_trie();
+    return test::finish("concurrent_test");
+}
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "DurableTrie.hpp"
+#include "tests/check.hpp"
+
+//recovery of DurableTrie: replaying logs, checkpoints followed by logs, torn and corrupt records
+//and a writer killed in the middle of its work
+
+namespace fs = std::filesystem;
+
+//trivially copyable without a default constructor, recovery has to build it from the logged bytes
+struct Score
+{
+    explicit Score(uint64_t v) : value(v) {}
+    uint64_t value;
+};
+
+using Element = std::pair<std::string, Score>;
+using Durable = jzt::qp::DurableTrie<Element, true>;
+using Map = std::map<std::string, uint64_t>;
+
+static Map contents(Durable& t)
+{
+    Map out;
+    t.for_each([&](const Element& e) { out.emplace(e.first, e.second.value); });
+    return out;
+}
+
+//the i-th write of a run, the same for every process given the seed
+struct Op
+{
+    bool insert;
+    std::string key;
+    uint64_t value;
+};
+
+static std::vector<Op> make_ops(uint64_t seed, std::size_t count)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<Op> ops;
+    for (std::size_t i = 0; i < count; i++) {
+        ops.push_back({rng() % 3 != 0, "key/" + std::to_string(rng() % 300), rng()});
+    }
+    return ops;
+}
+
+static void perform(Durable& t, Map& ref, const Op& op)
+{
+    if (op.insert) {
+        CHECK(t.emplace(op.key, Score(op.value)) == ref.emplace(op.key, op.value).second);
+    } else {
+        CHECK(t.remove(op.key) == (ref.erase(op.key) == 1));
+    }
+}
+
+static void model(Map& ref, const Op& op)
+{
+    if (op.insert) {
+        ref.emplace(op.key, op.value);
+    } else {
+        ref.erase(op.key);
+    }
+}
+
+static std::vector<fs::path> files(const fs::path& dir, const std::string& kind)
+{
+    std::vector<fs::path> out;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (entry.path().filename().string().compare(0, kind.size() + 1, kind + ".") == 0) {
+            out.push_back(entry.path());
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static void append_bytes(const fs::path& path, const std::string& bytes)
+{
+    std::ofstream os(path, std::ios::binary | std::ios::app);
+    os.write(bytes.data(), bytes.size());
+}
+
+static void check_replay(const fs::path& dir)
+{
+    Map ref;
+    auto ops = make_ops(1, 500);
+    {
+        Durable t(dir.string(), 0);
+        for (auto& op : ops) {
+            perform(t, ref, op);
+        }
+    }
+    Durable t(dir.string(), 0);
+    CHECK(contents(t) == ref);
+    CHECK(files(dir, "checkpoint").empty());
+}
+
+static void check_checkpoint_then_replay(const fs::path& dir)
+{
+    Map ref;
+    auto ops = make_ops(2, 1000);
+    {
+        Durable t(dir.string(), 0);
+        for (std::size_t i = 0; i < 600; i++) {
+            perform(t, ref, ops[i]);
+        }
+        t.checkpoint();
+        //the logs the checkpoint covers are gone
+        CHECK(files(dir, "checkpoint").size() == 1);
+        CHECK(files(dir, "wal").size() == 1);
+        for (std::size_t i = 600; i < ops.size(); i++) {
+            perform(t, ref, ops[i]);
+        }
+    }
+    {
+        Durable t(dir.string(), 0);
+        CHECK(contents(t) == ref);
+        //a second checkpoint on top of the replayed records, then more records after it
+        t.checkpoint();
+        for (auto& op : make_ops(3, 200)) {
+            perform(t, ref, op);
+        }
+    }
+    Durable t(dir.string(), 0);
+    CHECK(contents(t) == ref);
+    CHECK(files(dir, "checkpoint").size() == 1);
+}
+
+static void check_torn_tail(const fs::path& dir)
+{
+    Map ref;
+    {
+        Durable t(dir.string(), 0);
+        for (auto& op : make_ops(4, 300)) {
+            perform(t, ref, op);
+        }
+    }
+    //a record cut short and one whose checksum does not match, as left by a crash while writing
+    fs::path tail = files(dir, "wal").back();
+    auto size = fs::file_size(tail);
+    std::string record = {1, 7, 'k', 'e', 'y', '/', '9', '9', '9'};
+    append_bytes(tail, record);
+    {
+        Durable t(dir.string(), 0);
+        CHECK(contents(t) == ref);
+        CHECK(fs::file_size(tail) == size);
+        CHECK(t.emplace("after/torn", Score(1)));
+        ref.emplace("after/torn", 1);
+    }
+    tail = files(dir, "wal").back();
+    size = fs::file_size(tail);
+    append_bytes(tail, record + std::string(8 + 4, '\x5a'));
+    {
+        Durable t(dir.string(), 0);
+        CHECK(contents(t) == ref);
+        CHECK(fs::file_size(tail) == size);
+    }
+
+    //the same damage in a log that is not the last one is not a torn write
+    auto logs = files(dir, "wal");
+    CHECK(logs.size() >= 2);
+    append_bytes(logs.front(), record);
+    bool threw = false;
+    try {
+        Durable t(dir.string(), 0);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+//a log that cannot grow any more: the write that hits it throws and so does every call after it, the
+//writes synced before it are recovered
+static void check_failed_write(const fs::path& dir)
+{
+    auto ops = make_ops(5, 2000);
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        signal(SIGXFSZ, SIG_IGN);
+        rlimit limit = {4096, 4096};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        Durable t(dir.string(), 0);
+        std::size_t i = 0;
+        try {
+            for (; i < ops.size(); i++) {
+                if (ops[i].insert) {
+                    t.emplace(ops[i].key, Score(ops[i].value));
+                } else {
+                    t.remove(ops[i].key);
+                }
+            }
+        } catch (const std::system_error&) {
+        }
+        int later = 0;
+        try {
+            t.emplace("after/failure", Score(1));
+        } catch (const std::runtime_error&) {
+            later++;
+        }
+        try {
+            t.contains("after/failure");
+        } catch (const std::runtime_error&) {
+            later++;
+        }
+        try {
+            t.checkpoint();
+        } catch (const std::runtime_error&) {
+            later++;
+        }
+        uint64_t report[2] = {i, (uint64_t)later};
+        _exit(write(fds[1], report, sizeof(report)) == sizeof(report) ? 0 : 1);
+    }
+    close(fds[1]);
+    uint64_t report[2] = {0, 0};
+    CHECK(read(fds[0], report, sizeof(report)) == sizeof(report));
+    close(fds[0]);
+    int status;
+    waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(report[0] < ops.size() && report[1] == 3);
+
+    Map ref;
+    for (std::size_t i = 0; i < report[0]; i++) {
+        model(ref, ops[i]);
+    }
+    Durable t(dir.string(), 0);
+    CHECK(contents(t) == ref);
+}
+
+//a child writes and reports each write once it returned, the parent kills it at some point. every
+//reported write must survive, the one in flight may or may not
+static void check_crash(const fs::path& dir, uint64_t seed, std::size_t kill_after)
+{
+    auto ops = make_ops(seed, 3000);
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        //small enough that background checkpoints run while writing
+        Durable t(dir.string(), 4096);
+        for (std::size_t i = 0; i < ops.size(); i++) {
+            if (ops[i].insert) {
+                t.emplace(ops[i].key, Score(ops[i].value));
+            } else {
+                t.remove(ops[i].key);
+            }
+            char done = 1;
+            if (write(fds[1], &done, 1) != 1) {
+                break;
+            }
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    std::size_t acknowledged = 0;
+    char done;
+    while (acknowledged < kill_after && read(fds[0], &done, 1) == 1) {
+        acknowledged++;
+    }
+    kill(child, SIGKILL);
+    int status;
+    waitpid(child, &status, 0);
+    //writes that returned before the kill but were not read yet
+    while (read(fds[0], &done, 1) == 1) {
+        acknowledged++;
+    }
+    close(fds[0]);
+
+    Map before, after;
+    for (std::size_t i = 0; i < acknowledged; i++) {
+        model(before, ops[i]);
+    }
+    after = before;
+    if (acknowledged < ops.size()) {
+        model(after, ops[acknowledged]);
+    }
+    Durable t(dir.string(), 0);
+    Map got = contents(t);
+    CHECK(got == before || got == after);
+}
+
+int main()
+{
+    fs::path base = fs::temp_directory_path() / ("qp_trie_durable_test." + std::to_string(getpid()));
+    fs::remove_all(base);
+    check_replay(base / "replay");
+    check_checkpoint_then_replay(base / "checkpoint");
+    check_torn_tail(base / "torn");
+    check_failed_write(base / "failed");
+    for (std::size_t kill_after : {0, 1, 700, 2500}) {
+        check_crash(base / ("crash." + std::to_string(kill_after)), 10 + kill_after, kill_after);
+    }
+    fs::remove_all(base);
+    return test::finish("durable_test");
+}
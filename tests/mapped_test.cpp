@@ -0,0 +1,221 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "MappedTrie.hpp"
+#include "tests/check.hpp"
+
+//tries written by write_mapped and read back through MappedTrie against std::map and std::set,
+//and images that are cut short or damaged
+
+namespace fs = std::filesystem;
+
+using Map = std::map<std::string, uint64_t>;
+using Set = std::set<std::string>;
+using Element = std::pair<std::string, uint64_t>;
+
+static bool starts_with(const std::string& key, const std::string& prefix)
+{
+    return key.compare(0, prefix.size(), prefix) == 0;
+}
+
+template <typename Mapped>
+static Map collect(const Mapped& m, typename Mapped::Iterator it)
+{
+    Map out;
+    for (; it != m.end(); ++it) {
+        out.emplace(std::string(it.key()), it.value());
+    }
+    return out;
+}
+
+template <typename Mapped>
+static Set collect_keys(const Mapped& m, typename Mapped::Iterator it)
+{
+    Set out;
+    for (; it != m.end(); ++it) {
+        out.emplace(it.key());
+    }
+    return out;
+}
+
+template <unsigned Bits>
+static void check_map(const fs::path& path, const Map& ref, std::mt19937_64& rng, int alphabet_size)
+{
+    jzt::qp::Trie<Element, true, Bits> t;
+    for (auto& kv : ref) {
+        t.emplace(kv.first, kv.second);
+    }
+    jzt::qp::write_mapped(t, path.string());
+    jzt::qp::MappedTrie<Element, true, Bits> m(path.string());
+    CHECK(m.size() == ref.size() && m.empty() == ref.empty());
+
+    //in key order, as the pairs operator* returns
+    std::vector<Element> seen;
+    for (auto it = m.begin(); it != m.end(); ++it) {
+        seen.emplace_back(std::string((*it).first), (*it).second);
+    }
+    CHECK(seen == std::vector<Element>(ref.begin(), ref.end()));
+
+    for (int q = 0; q < 200; q++) {
+        std::string key = test::random_key(rng, 8, alphabet_size);
+        if (!ref.empty() && rng() % 2) {
+            key = std::next(ref.begin(), rng() % ref.size())->first;
+        }
+        auto found = m.find(key);
+        CHECK((found != m.end()) == (ref.count(key) == 1));
+        CHECK(m.contains(key) == (ref.count(key) == 1));
+        //find goes on in key order
+        if (found != m.end()) {
+            CHECK(collect(m, found) == Map(ref.find(key), ref.end()));
+        }
+
+        std::string prefix = key.substr(0, rng() % 4);
+        Map want;
+        for (auto& kv : ref) {
+            if (starts_with(kv.first, prefix)) {
+                want.insert(kv);
+            }
+        }
+        CHECK(collect(m, m.prefix(prefix)) == want);
+        CHECK(m.contains_prefix(prefix) == !want.empty());
+    }
+}
+
+template <unsigned Bits>
+static void check_set(const fs::path& path, const Set& ref, std::mt19937_64& rng, int alphabet_size)
+{
+    jzt::qp::Trie<std::string, false, Bits> t;
+    for (auto& key : ref) {
+        t.emplace(key);
+    }
+    jzt::qp::write_mapped(t, path.string());
+    jzt::qp::MappedTrie<std::string, false, Bits> m(path.string());
+    CHECK(m.size() == ref.size());
+    CHECK(collect_keys(m, m.begin()) == ref);
+
+    for (int q = 0; q < 200; q++) {
+        std::string key = test::random_key(rng, 8, alphabet_size);
+        if (!ref.empty() && rng() % 2) {
+            key = *std::next(ref.begin(), rng() % ref.size());
+        }
+        auto found = m.find(key);
+        CHECK((found != m.end()) == (ref.count(key) == 1));
+        if (found != m.end()) {
+            CHECK(*found == key);
+            CHECK(collect_keys(m, found) == Set(ref.find(key), ref.end()));
+        }
+        std::string prefix = key.substr(0, rng() % 4);
+        Set want;
+        for (auto& k : ref) {
+            if (starts_with(k, prefix)) {
+                want.insert(k);
+            }
+        }
+        CHECK(collect_keys(m, m.prefix(prefix)) == want);
+        CHECK(m.contains_prefix(prefix) == !want.empty());
+    }
+}
+
+template <unsigned Bits>
+static void check_round_trip(const fs::path& dir, uint64_t seed, int alphabet_size)
+{
+    std::mt19937_64 rng(seed);
+    fs::path path = dir / ("image." + std::to_string(Bits));
+    for (std::size_t size : {0, 1, 2, 100, 2000}) {
+        Map map;
+        Set set;
+        while (map.size() < size) {
+            std::string key = test::random_key(rng, 12, alphabet_size);
+            map.emplace(key, rng());
+            set.insert(key);
+        }
+        check_map<Bits>(path, map, rng, alphabet_size);
+        check_set<Bits>(path, set, rng, alphabet_size);
+    }
+}
+
+template <typename Mapped>
+static bool rejected(const fs::path& path)
+{
+    try {
+        Mapped m(path.string());
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+static void check_damage(const fs::path& dir)
+{
+    using Mapped = jzt::qp::MappedTrie<Element, true>;
+    std::mt19937_64 rng(7);
+    jzt::qp::Trie<Element, true> t;
+    for (int i = 0; i < 1000; i++) {
+        t.emplace(test::random_key(rng, 8, 8), i);
+    }
+    fs::path path = dir / "damaged";
+    jzt::qp::write_mapped(t, path.string());
+    CHECK(!rejected<Mapped>(path));
+    //written with another fan-out
+    using Wide = jzt::qp::MappedTrie<Element, true, 8>;
+    CHECK(rejected<Wide>(path));
+
+    std::string image;
+    {
+        std::ifstream is(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+    auto write = [&](const std::string& bytes) {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        os.write(bytes.data(), bytes.size());
+    };
+    //cut short, also below the header
+    write(image.substr(0, image.size() / 2));
+    CHECK(rejected<Mapped>(path));
+    write(image.substr(0, 10));
+    CHECK(rejected<Mapped>(path));
+
+    //a root pointing past the end
+    const std::size_t root_offset = offsetof(jzt::detail::qp::MappedHeader, root) + sizeof(uint64_t);
+    std::string bad = image;
+    uint64_t offset = image.size() + 4096;
+    std::memcpy(&bad[root_offset], &offset, sizeof(offset));
+    write(bad);
+    CHECK(rejected<Mapped>(path));
+
+    //a twig of the root pointing at the twig array of the root
+    bad = image;
+    std::memcpy(&offset, &image[root_offset], sizeof(offset));
+    std::size_t first_twig = offset + jzt::detail::qp::MappedBitmap<4>::size();
+    std::memcpy(&bad[first_twig + sizeof(uint64_t)], &offset, sizeof(offset));
+    write(bad);
+    CHECK(rejected<Mapped>(path));
+}
+
+int main()
+{
+    fs::path dir = fs::temp_directory_path() / ("qp_trie_mapped_test." + std::to_string(getpid()));
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    for (int alphabet_size : {2, 8}) {
+        check_round_trip<4>(dir, 1, alphabet_size);
+        check_round_trip<5>(dir, 2, alphabet_size);
+        check_round_trip<6>(dir, 3, alphabet_size);
+        check_round_trip<8>(dir, 4, alphabet_size);
+    }
+    check_damage(dir);
+    fs::remove_all(dir);
+    return test::finish("mapped_test");
+}
@@ -0,0 +1,652 @@
+#include <algorithm>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory_resource>
+#include <regex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Trie.hpp"
+#include "Pattern.hpp"
+#include "tests/check.hpp"
+
+//every query of Trie and Snapshot against the same query on a std::map holding the same elements
+
+using Map = std::map<std::string, int>;
+using Element = std::pair<std::string, int>;
+
+struct ByValue
+{
+    int operator()(const Element& e) const
+    {
+        return e.second;
+    }
+};
+
+static unsigned edit_distance(const std::string& a, const std::string& b)
+{
+    std::vector<unsigned> row(b.size() + 1);
+    for (std::size_t j = 0; j <= b.size(); j++) {
+        row[j] = j;
+    }
+    for (std::size_t i = 1; i <= a.size(); i++) {
+        unsigned diagonal = row[0];
+        row[0] = i;
+        for (std::size_t j = 1; j <= b.size(); j++) {
+            unsigned up = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+            diagonal = up;
+        }
+    }
+    return row[b.size()];
+}
+
+static bool starts_with(const std::string& key, const std::string& prefix)
+{
+    return key.compare(0, prefix.size(), prefix) == 0;
+}
+
+//the elements from it up to end, as a map for comparison
+template <typename It>
+static Map collect(It it, It end)
+{
+    Map out;
+    std::string last;
+    bool first = true;
+    for (; it != end; ++it) {
+        CHECK(first || last < it->first);
+        first = false;
+        last = it->first;
+        out.emplace(it->first, it->second);
+    }
+    return out;
+}
+
+template <typename TrieType>
+static void check_iteration(TrieType& t, const Map& ref)
+{
+    CHECK(collect(t.begin(), t.end()) == ref);
+    std::vector<std::string> backward;
+    for (auto it = t.rbegin(); it != t.rend(); ++it) {
+        backward.push_back(it->first);
+    }
+    std::vector<std::string> want;
+    for (auto it = ref.rbegin(); it != ref.rend(); ++it) {
+        want.push_back(it->first);
+    }
+    CHECK(backward == want);
+}
+
+//queries that need no summary policy, on a Trie or a Snapshot
+template <typename TrieType>
+static void check_queries(TrieType& t, const Map& ref, std::mt19937_64& rng, int alphabet_size)
+{
+    for (int q = 0; q < 100; q++) {
+        std::string key = test::random_key(rng, 8, alphabet_size);
+        auto found = t.find(key);
+        auto it = ref.find(key);
+        CHECK((found != t.end()) == (it != ref.end()));
+        if (it != ref.end() && found != t.end()) {
+            CHECK(found->first == key && found->second == it->second);
+        }
+        CHECK(t.contains(key) == (it != ref.end()));
+
+        auto lower = t.lower_bound(key);
+        auto ref_lower = ref.lower_bound(key);
+        CHECK((lower == t.end()) == (ref_lower == ref.end()));
+        if (lower != t.end() && ref_lower != ref.end()) {
+            CHECK(lower->first == ref_lower->first);
+        }
+        auto upper = t.upper_bound(key);
+        auto ref_upper = ref.upper_bound(key);
+        CHECK((upper == t.end()) == (ref_upper == ref.end()));
+        if (upper != t.end() && ref_upper != ref.end()) {
+            CHECK(upper->first == ref_upper->first);
+        }
+
+        std::string to = test::random_key(rng, 8, alphabet_size);
+        if (to < key) {
+            std::swap(key, to);
+        }
+        auto range = t.range(key, to);
+        CHECK(collect(range.first, range.second) == Map(ref.lower_bound(key), ref.lower_bound(to)));
+
+        std::string prefix = test::random_key(rng, 3, alphabet_size);
+        Map want;
+        for (auto& [k, v] : ref) {
+            if (starts_with(k, prefix)) {
+                want.emplace(k, v);
+            }
+        }
+        CHECK(collect(t.prefix(prefix), t.end()) == want);
+
+        std::string longest;
+        bool any = false;
+        for (std::size_t n = 0; n <= key.size(); n++) {
+            if (ref.count(key.substr(0, n))) {
+                longest = key.substr(0, n);
+                any = true;
+            }
+        }
+        auto match = t.longest_prefix_match(key);
+        CHECK((match != t.end()) == any);
+        if (match != t.end()) {
+            CHECK(match->first == longest);
+        }
+
+        unsigned distance = rng() % 3;
+        std::vector<std::pair<std::string, unsigned>> want_near;
+        for (auto& [k, v] : ref) {
+            unsigned d = edit_distance(k, key);
+            if (d <= distance) {
+                want_near.emplace_back(k, d);
+            }
+        }
+        std::vector<std::pair<decltype(t.end()), unsigned>> got_near;
+        t.fuzzy_find(key, distance, std::back_inserter(got_near));
+        std::vector<std::pair<std::string, unsigned>> got;
+        for (auto& [e, d] : got_near) {
+            got.emplace_back(e->first, d);
+        }
+        CHECK(got == want_near);
+    }
+}
+
+template <unsigned Bits>
+static void check_trie(uint64_t seed, int alphabet_size)
+{
+    std::mt19937_64 rng(seed);
+    jzt::qp::Trie<Element, true, Bits, jzt::qp::LeafCount> t;
+    Map ref;
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 1500; i++) {
+            std::string key = test::random_key(rng, 8, alphabet_size);
+            int value = rng() % 1000;
+            switch (rng() % 4) {
+            case 0:
+            case 1:
+                CHECK(t.emplace(key, value) == ref.emplace(key, value).second);
+                break;
+            case 2:
+                CHECK(t.remove(key) == (ref.erase(key) == 1));
+                break;
+            default:
+                CHECK(t.update(key, [&](int& v) { v = value; }) == (ref.count(key) == 1));
+                if (ref.count(key)) {
+                    ref[key] = value;
+                }
+            }
+        }
+        check_iteration(t, ref);
+        check_queries(t, ref, rng, alphabet_size);
+
+        //leaf counts, and equal_range which only the trie has
+        for (int q = 0; q < 100; q++) {
+            std::string key = test::random_key(rng, 8, alphabet_size);
+            std::string prefix = key.substr(0, rng() % 4);
+            uint64_t with_prefix = 0;
+            for (auto& kv : ref) {
+                with_prefix += starts_with(kv.first, prefix);
+            }
+            CHECK(t.count_prefix(prefix) == with_prefix);
+            auto equal = t.equal_range(key);
+            CHECK(collect(equal.first, equal.second) == Map(ref.lower_bound(key), ref.upper_bound(key)));
+            uint64_t rank = std::distance(ref.begin(), ref.lower_bound(key));
+            CHECK(t.rank(key) == rank);
+            auto selected = t.select(rank);
+            CHECK((selected == t.end()) == (rank == ref.size()));
+            if (selected != t.end()) {
+                CHECK(selected->first == ref.lower_bound(key)->first);
+            }
+        }
+
+        std::vector<std::string> keys;
+        for (int q = 0; q < 40; q++) {
+            keys.push_back(test::random_key(rng, 8, alphabet_size));
+        }
+        std::vector<bool> contained;
+        t.contains_batch(keys.begin(), keys.end(), std::back_inserter(contained));
+        std::vector<typename decltype(t)::IteratorType> found;
+        t.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+        CHECK(contained.size() == keys.size() && found.size() == keys.size());
+        for (std::size_t q = 0; q < keys.size() && q < contained.size() && q < found.size(); q++) {
+            CHECK(contained[q] == (ref.count(keys[q]) == 1));
+            CHECK((found[q] != t.end()) == contained[q]);
+        }
+
+        //the snapshot keeps the elements of the moment it was taken while the trie moves on
+        auto snapshot = t.snapshot();
+        Map frozen = ref;
+        for (int i = 0; i < 300; i++) {
+            std::string key = test::random_key(rng, 8, alphabet_size);
+            if (rng() % 2) {
+                t.emplace(key, 1);
+                ref.emplace(key, 1);
+            } else {
+                t.remove(key);
+                ref.erase(key);
+            }
+        }
+        //writes through mutable iterators copy what the snapshot still shares
+        for (auto it = t.begin(); it != t.end(); ++it) {
+            it->second += 1000;
+        }
+        for (auto& kv : ref) {
+            kv.second += 1000;
+        }
+        if (!ref.empty()) {
+            t.find(ref.begin()->first)->second = -1;
+            ref.begin()->second = -1;
+        }
+        check_iteration(snapshot, frozen);
+        check_queries(snapshot, frozen, rng, alphabet_size);
+        check_iteration(t, ref);
+    }
+
+    std::vector<Element> sorted(ref.begin(), ref.end());
+    jzt::qp::Trie<Element, true, Bits, jzt::qp::LeafCount> built;
+    built.build_sorted(sorted.begin(), sorted.end());
+    check_iteration(built, ref);
+    CHECK(built.count_prefix("") == ref.size());
+}
+
+//large enough for the subtries to be built on several threads
+static void check_parallel_build()
+{
+    std::mt19937_64 rng(3);
+    Map ref;
+    while (ref.size() < 100000) {
+        ref.emplace(test::random_key(rng, 12, 8), rng() % 1000);
+    }
+    std::vector<Element> sorted(ref.begin(), ref.end());
+    jzt::qp::Trie<Element, true, 4, jzt::qp::LeafCount> t;
+    t.build_sorted_parallel(sorted.begin(), sorted.end(), 4);
+    check_iteration(t, ref);
+    CHECK(t.count_prefix("") == ref.size());
+    check_queries(t, ref, rng, 8);
+
+    std::swap(sorted[10], sorted[20000]);
+    jzt::qp::Trie<Element, true> unsorted;
+    bool threw = false;
+    try {
+        unsorted.build_sorted_parallel(sorted.begin(), sorted.end(), 4);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    //reversed, every split of the planner sees its range in the wrong order
+    std::vector<Element> reversed(ref.rbegin(), ref.rend());
+    threw = false;
+    try {
+        unsorted.build_sorted_parallel(reversed.begin(), reversed.end(), 4);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+//top_k and update under a summary over the values
+template <unsigned Bits>
+static void check_top_k(uint64_t seed, int alphabet_size)
+{
+    std::mt19937_64 rng(seed);
+    jzt::qp::Trie<Element, true, Bits, jzt::qp::MaxScore<ByValue, int>> t;
+    Map ref;
+    for (int i = 0; i < 3000; i++) {
+        std::string key = test::random_key(rng, 7, alphabet_size);
+        int value = rng() % 1000;
+        switch (rng() % 3) {
+        case 0:
+            t.emplace(key, value);
+            ref.emplace(key, value);
+            break;
+        case 1:
+            t.remove(key);
+            ref.erase(key);
+            break;
+        default:
+            t.update(key, [&](int& v) { v = value; });
+            if (ref.count(key)) {
+                ref[key] = value;
+            }
+        }
+    }
+    for (int q = 0; q < 300; q++) {
+        std::string prefix = test::random_key(rng, 3, alphabet_size);
+        std::size_t k = rng() % 12;
+        std::vector<int> want;
+        for (auto& [key, value] : ref) {
+            if (starts_with(key, prefix)) {
+                want.push_back(value);
+            }
+        }
+        std::sort(want.rbegin(), want.rend());
+        want.resize(std::min(want.size(), k));
+        std::vector<typename decltype(t)::IteratorType> best;
+        t.top_k(prefix, k, std::back_inserter(best));
+        std::vector<int> got;
+        for (auto& it : best) {
+            CHECK(starts_with(it->first, prefix));
+            got.push_back(it->second);
+        }
+        CHECK(got == want);
+    }
+}
+
+static void check_match()
+{
+    std::mt19937_64 rng(7);
+    jzt::qp::Trie<std::string, false> t;
+    std::set<std::string> ref;
+    for (int i = 0; i < 5000; i++) {
+        std::string key = test::random_key(rng, 6, 2) + (rng() % 2 ? ":" : "") + test::random_key(rng, 4, 6);
+        t.emplace(key);
+        ref.insert(key);
+    }
+    //the keys the walk over the trie finds are the keys want holds for, in order
+    auto check_pattern = [&](const jzt::qp::Pattern& pattern, auto&& want_match) {
+        std::vector<std::string> want;
+        for (auto& key : ref) {
+            CHECK(pattern.matches(key) == want_match(key));
+            if (want_match(key)) {
+                want.push_back(key);
+            }
+        }
+        std::vector<decltype(t)::IteratorType> matched;
+        t.match(pattern, std::back_inserter(matched));
+        std::vector<std::string> got;
+        for (auto& it : matched) {
+            got.push_back(*it);
+        }
+        CHECK(got == want);
+    };
+    for (const char* glob : {"a*", "*b", "a?b*", "[a-b]*:*", "[!a]*", "*:*z", "ab:?"}) {
+        jzt::qp::Pattern pattern = jzt::qp::Pattern::glob(glob);
+        check_pattern(pattern, [&](const std::string& key) { return pattern.matches(key); });
+    }
+    CHECK(jzt::qp::Pattern::glob("a*b").matches("axxb") && !jzt::qp::Pattern::glob("a*b").matches("axxbc"));
+
+    //regexes against std::regex, which reads ^ and $ as anchors where Pattern ignores them
+    for (const char* regex : {"a(b|z)*", "(ab|ba)+:?z*", "a?b+:.*", "[ab]+:[^a]*", "^a.*$", "(a|b)(a|b)", "a|b|:",
+                              ".*z", "[a-bz]*", "(a(b)?)+", "b*:(Z|z)?", "a\\*?b.?"}) {
+        std::regex std_regex(regex);
+        check_pattern(jzt::qp::Pattern::regex(regex), [&](const std::string& key) { return std::regex_match(key, std_regex); });
+    }
+    CHECK(jzt::qp::Pattern::regex("^ab$").matches("ab") && !jzt::qp::Pattern::regex("^ab$").matches("abab"));
+    CHECK(jzt::qp::Pattern::regex("a\\*").matches("a*") && !jzt::qp::Pattern::regex("a\\*").matches("a"));
+
+    for (const char* bad : {"*a", "a|+b", "(?)", "(ab", "a(b|c", "ab)", "a|b)", "[z-a]", "[ab"}) {
+        bool threw = false;
+        try {
+            jzt::qp::Pattern::regex(bad);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+}
+
+//key types other than std::string
+struct Name
+{
+    std::string str;
+    operator std::string_view() const
+    {
+        return str;
+    }
+};
+
+static void check_key_types()
+{
+    jzt::qp::Trie<std::pair<const char*, int>, true> by_pointer;
+    std::vector<std::string> storage = {"12345", "abcxy", "ab", "ad", "a"};
+    for (std::size_t i = 0; i < storage.size(); i++) {
+        CHECK(by_pointer.emplace(storage[i].c_str(), (int)i));
+    }
+    CHECK(!by_pointer.emplace(storage[0].c_str(), 9));
+    std::vector<std::string> under_a;
+    for (auto it = by_pointer.prefix("a"); it != by_pointer.end(); ++it) {
+        under_a.push_back(it->first);
+    }
+    CHECK((under_a == std::vector<std::string>{"a", "ab", "abcxy", "ad"}));
+    CHECK(by_pointer.contains_prefix(std::string("12")));
+
+    jzt::qp::Trie<std::pair<Name, int>, true> by_name;
+    CHECK(by_name.emplace(Name{"uvw"}, 2));
+    CHECK(by_name.contains("uvw") && by_name.contains(Name{"uvw"}));
+    CHECK(by_name.remove(Name{"uvw"}) && !by_name.contains("uvw"));
+
+    jzt::qp::Trie<std::string, false> strings;
+    CHECK(strings.emplace(5, 'q'));
+    CHECK(strings.contains("qqqqq"));
+    const auto& frozen = strings;
+    CHECK(*frozen.begin() == "qqqqq" && std::next(frozen.begin()) == frozen.end());
+}
+
+//the shape of a trie small enough to draw. with 4 bit nybbles "a", "ab", "b" and "c" all start
+//with 6, the root branch tests the second nybble (1, 2, 3) and the branch below it the third one,
+//where "a" has ended and sits in the head twig:
+//  root [1] -> branch { head "a", [6] "ab" }, [2] "b", [3] "c"
+static void check_stats()
+{
+    using Node = jzt::detail::qp::Node<std::string, false, 4>;
+    std::vector<std::string> keys = {"a", "ab", "b", "c"};
+    jzt::qp::Trie<std::string, false> t;
+    t.build_sorted(keys.begin(), keys.end());
+    auto st = t.stats();
+    CHECK(st.leaves == 4 && st.branches == 2 && st.head_twigs == 1);
+    CHECK(st.leaf_depths == std::vector<uint64_t>({0, 2, 2}));
+    std::vector<uint64_t> fanouts(Node::TwigMax + 1);
+    fanouts[2] = fanouts[3] = 1;
+    CHECK(st.fanouts == fanouts);
+    //built bottom-up, every array has its final size
+    CHECK(st.capacities[2] == std::vector<uint64_t>({0, 0, 1}) && st.capacities[3] == std::vector<uint64_t>({0, 0, 0, 1}));
+    CHECK(st.twig_bytes == 5 * sizeof(Node) && st.slack_bytes == 0);
+    CHECK(st.key_bytes == 5 && st.heap_bytes == 0);
+    CHECK(st.pool_bytes >= st.twig_bytes && st.free_bytes == 0);
+
+    //the same shape one insertion at a time, the arrays may have grown with slack
+    jzt::qp::Trie<std::string, false> grown;
+    for (auto& key : keys) {
+        grown.emplace(key);
+    }
+    auto gst = grown.stats();
+    CHECK(gst.leaves == st.leaves && gst.branches == st.branches && gst.head_twigs == st.head_twigs);
+    CHECK(gst.leaf_depths == st.leaf_depths && gst.fanouts == st.fanouts);
+    CHECK(gst.twig_bytes - gst.slack_bytes == st.twig_bytes);
+    //"c" leaves the root, its array goes back to the pool
+    grown.remove("c");
+    gst = grown.stats();
+    CHECK(gst.leaves == 3 && gst.fanouts[2] == 2 && gst.fanouts[3] == 0 && gst.free_bytes > 0);
+
+    //a root leaf has no branch, its key is beyond the small buffer of std::string
+    jzt::qp::Trie<std::string, false> single;
+    CHECK(single.stats().leaves == 0 && single.stats().leaf_depths.empty() && single.stats().pool_bytes == 0);
+    single.emplace(std::string(100, 'x'));
+    st = single.stats();
+    CHECK(st.leaves == 1 && st.branches == 0 && st.leaf_depths == std::vector<uint64_t>({1}));
+    CHECK(st.twig_bytes == 0 && st.key_bytes == 100 && st.heap_bytes >= 100);
+}
+
+//counters of known operations, kept apart from other tries by their tag
+struct CountersTag {};
+using Counters = jzt::qp::ThreadCounters<CountersTag>;
+using Counted = jzt::qp::Trie<std::string, false, 4, jzt::qp::NoSummary, Counters>;
+
+static uint64_t counted(jzt::qp::Counter c)
+{
+    return Counters::totals()[(std::size_t)c];
+}
+
+static void check_counters()
+{
+    using jzt::qp::Counter;
+    //the counters are a policy of the trie, not state in its nodes
+    static_assert(sizeof(jzt::detail::qp::Node<std::string, false, 4>) == sizeof(jzt::detail::qp::Node<std::string, false, 4, jzt::qp::NoSummary, Counters>));
+    static_assert(sizeof(jzt::qp::Trie<std::string, false>) == sizeof(Counted));
+
+    {
+        Counted t;
+        t.emplace("a");
+        uint64_t bursts = counted(Counter::LeafBursts), allocations = counted(Counter::TwigAllocations);
+        //the root leaf turns into a branch with a new array of two twigs
+        t.emplace("b");
+        CHECK(counted(Counter::LeafBursts) == bursts + 1 && counted(Counter::TwigAllocations) == allocations + 1);
+        //and back into a leaf, the array is freed
+        uint64_t collapses = counted(Counter::RemoveCollapses), frees = counted(Counter::TwigFrees);
+        CHECK(t.remove("b"));
+        CHECK(counted(Counter::RemoveCollapses) == collapses + 1 && counted(Counter::TwigFrees) == frees + 1);
+        CHECK(!t.remove("b"));
+        CHECK(counted(Counter::RemoveCollapses) == collapses + 1);
+    }
+
+    //every array allocated is freed again once the trie is empty or destroyed
+    std::mt19937_64 rng(11);
+    {
+        Counted t;
+        std::vector<std::string> keys;
+        for (int i = 0; i < 2000; i++) {
+            keys.push_back(test::random_key(rng, 8, 8));
+            t.emplace(keys.back());
+        }
+        for (std::size_t i = 0; i < keys.size() / 2; i++) {
+            t.remove(keys[i]);
+        }
+        CHECK(counted(Counter::TwigAllocations) > counted(Counter::TwigFrees));
+    }
+    CHECK(counted(Counter::TwigAllocations) == counted(Counter::TwigFrees));
+
+    //what a thread counted is still in the totals after it exited
+    uint64_t bursts = counted(Counter::LeafBursts);
+    std::thread worker([]() {
+        Counted t;
+        t.emplace("x");
+        t.emplace("y");
+    });
+    worker.join();
+    CHECK(counted(Counter::LeafBursts) == bursts + 1);
+}
+
+//a memory resource that counts what goes through it
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+    std::size_t outstanding = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        allocations++;
+        outstanding += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        deallocations++;
+        outstanding -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+static void check_memory_resource()
+{
+    std::mt19937_64 rng(13);
+    CountingResource counting, unused;
+    std::pmr::memory_resource* previous = std::pmr::set_default_resource(&unused);
+    {
+        jzt::qp::Trie<Element, true> t(&counting);
+        CHECK(t.get_allocator().resource() == &counting);
+        Map ref;
+        for (int i = 0; i < 20000; i++) {
+            std::string key = test::random_key(rng, 8, 8);
+            if (rng() % 3) {
+                CHECK(t.emplace(key, i) == ref.emplace(key, i).second);
+            } else {
+                CHECK(t.remove(key) == (ref.erase(key) == 1));
+            }
+        }
+        check_iteration(t, ref);
+        //every twig array lives in a chunk taken from the resource
+        CHECK(counting.allocations > 1 && counting.outstanding == t.stats().pool_bytes);
+        CHECK(counting.outstanding >= t.stats().twig_bytes);
+    }
+    CHECK(counting.deallocations == counting.allocations && counting.outstanding == 0);
+    CHECK(unused.allocations == 0);
+    std::pmr::set_default_resource(previous);
+
+    //an arena that never frees, the trie releases its chunks into it and the arena drops them at once
+    std::vector<std::byte> buffer(4 << 20);
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+    {
+        jzt::qp::Trie<Element, true> t(&arena);
+        Map ref;
+        for (int i = 0; i < 5000; i++) {
+            std::string key = test::random_key(rng, 8, 8);
+            CHECK(t.emplace(key, i) == ref.emplace(key, i).second);
+        }
+        for (int i = 0; i < 1000; i++) {
+            std::string key = test::random_key(rng, 8, 8);
+            CHECK(t.remove(key) == (ref.erase(key) == 1));
+        }
+        check_iteration(t, ref);
+        CHECK(t.stats().pool_bytes <= buffer.size());
+    }
+}
+
+//a snapshot left alive when its trie goes away would read freed twig arrays, the trie terminates
+static void check_snapshot_outlives_trie()
+{
+    pid_t child = fork();
+    if (child == 0) {
+        //the message of std::terminate is expected
+        std::freopen("/dev/null", "w", stderr);
+        auto* t = new jzt::qp::Trie<Element, true>();
+        for (int i = 0; i < 100; i++) {
+            t->emplace(std::to_string(i), i);
+        }
+        auto* snapshot = new jzt::qp::Trie<Element, true>::SnapshotType(t->snapshot());
+        delete t;
+        _exit(snapshot->contains("1") ? 0 : 1);
+    }
+    int status;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+
+int main()
+{
+    for (uint64_t seed = 1; seed <= 2; seed++) {
+        for (int alphabet_size : {2, 4, 8}) {
+            check_trie<4>(seed, alphabet_size);
+            check_trie<5>(seed, alphabet_size);
+            check_trie<6>(seed, alphabet_size);
+            check_trie<8>(seed, alphabet_size);
+            check_top_k<4>(seed, alphabet_size);
+            check_top_k<8>(seed, alphabet_size);
+        }
+    }
+    check_parallel_build();
+    check_match();
+    check_key_types();
+    check_stats();
+    check_counters();
+    check_memory_resource();
+    check_snapshot_outlives_trie();
+    return test::finish("trie_test");
+}